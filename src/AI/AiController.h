@@ -3,7 +3,12 @@
 
 #include "IGameController.h"
 
+#include <chrono>
 #include <random>
+#include <string>
+
+// Formats dt with a unit that fits its magnitude.
+std::string format_duration(std::chrono::duration<double> dt);
 
 class AiController : public IGameController {
 public:
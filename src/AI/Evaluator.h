@@ -0,0 +1,24 @@
+#ifndef EVALUATOR_H_
+#define EVALUATOR_H_
+
+#include "Board.h"
+
+// A static evaluation of a position, used at the leaves of a search.
+// Higher is better for the player.
+class Evaluator {
+public:
+    Evaluator() = default;
+    virtual ~Evaluator() = default;
+
+    Evaluator(const Evaluator& other) = default;
+    Evaluator(Evaluator&& other) noexcept = default;
+    Evaluator& operator=(const Evaluator& other) = default;
+    Evaluator& operator=(Evaluator&& other) noexcept = default;
+
+    virtual double evaluate(const Board& board) const = 0;
+    // True if every rotation and reflection of a board scores the same, so
+    // that a search may store them as one position.
+    virtual bool is_symmetric() const { return false; }
+};
+
+#endif
@@ -0,0 +1,439 @@
+#include "ExpectimaxController.h"
+
+#include <algorithm>
+#include <array>
+
+#include <imgui/imgui.h>
+
+#include "BoardAllocator.h"
+
+static constexpr double FOUR_PROBABILITY = Board::SPAWN_FOUR_PROBABILITY;
+static constexpr double TWO_PROBABILITY = 1.0 - FOUR_PROBABILITY;
+
+struct ExpectimaxController::SearchTask : public WorkStealingPool::Task {
+    virtual void execute() override {
+        if(is_chance) {
+            value = controller->expect_chance(board,
+                    depth,
+                    probability,
+                    controller->m_min_score,
+                    controller->m_max_score,
+                    stats);
+        } else {
+            value = controller->expect_max(board,
+                    depth,
+                    probability,
+                    controller->m_min_score,
+                    controller->m_max_score,
+                    stats);
+        }
+    }
+
+    ExpectimaxController* controller = nullptr;
+    PackedBoard board;
+    int depth = 0;
+    double probability = 1.0;
+    // Whether board is searched as a chance node or a move node.
+    bool is_chance = false;
+    double value = 0.0;
+    ExpectimaxStats stats;
+};
+
+ExpectimaxController::ExpectimaxController(
+        uint64_t seed, const SearchOptions& options)
+        : AiController(seed),
+          m_min_score(std::min(0.0, m_evaluator.min_score())),
+          m_max_score(std::max(0.0, m_evaluator.max_score())),
+          m_options(options) {
+    if(options.threads > 1 && options.split_depth > 0) {
+        m_scheduler = std::make_unique<WorkStealingPool>(options.threads);
+    } else if(options.threads > 1) {
+        m_pool = std::make_unique<ThreadPool>(options.threads);
+    }
+}
+
+void ExpectimaxController::do_turn(Board& board, const GameTime& time) {
+    if(board.is_lost()) {
+        return;
+    }
+    auto start = std::chrono::high_resolution_clock::now();
+
+    ShiftDirection move = ShiftDirection::Left;
+    if(PackedBoard::can_pack(board)) {
+        best_move(PackedBoard(board), move);
+    } else {
+        // Past 32768 the packed kernels can't represent the board, so just
+        // keep the game going with any legal move.
+        auto legal = board.legal_moves();
+        if(legal != 0) {
+            move = static_cast<ShiftDirection>(__builtin_ctz(legal));
+        }
+    }
+    board.do_move(move);
+    // The nodes give back their memory as they return, this only drops
+    // what an unwound search may have left behind.
+    BoardAllocator::local().reset();
+
+    m_move_time = std::chrono::high_resolution_clock::now() - start;
+}
+
+// Adds the node counts of part to total.
+static void add_counts(ExpectimaxStats& total, const ExpectimaxStats& part) {
+    total.move_nodes += part.move_nodes;
+    total.chance_nodes += part.chance_nodes;
+    total.evaluations += part.evaluations;
+    total.probability_cutoffs += part.probability_cutoffs;
+    total.chance_cutoffs += part.chance_cutoffs;
+    total.probe_cutoffs += part.probe_cutoffs;
+}
+
+bool ExpectimaxController::best_move(PackedBoard board, ShiftDirection& move) {
+    m_stats = ExpectimaxStats();
+    m_stats.depth = search_depth(board);
+    if(m_scheduler) {
+        return stealing_best_move(board, move);
+    }
+    if(m_pool) {
+        return parallel_best_move(board, move);
+    }
+
+    auto successors = board.successors();
+    bool found = false;
+    for(int i = 0; i < 4; ++i) {
+        auto dir = static_cast<ShiftDirection>(i);
+        if(!successors.is_legal(dir)) {
+            continue;
+        }
+        m_stats.move_nodes += 1;
+        double alpha = found ? m_stats.best_score : m_min_score;
+        double score = expect_chance(successors.boards[i],
+                m_stats.depth - 1,
+                1.0,
+                alpha,
+                m_max_score,
+                m_stats);
+        if(!found || score > m_stats.best_score) {
+            m_stats.best_score = score;
+            move = dir;
+            found = true;
+        }
+    }
+    return found;
+}
+
+bool ExpectimaxController::parallel_best_move(
+        PackedBoard board, ShiftDirection& move) {
+    // The moves are searched at once, so none of them can narrow the
+    // window of the others. Each gets the full window and its own counts.
+    auto successors = board.successors();
+    int depth = m_stats.depth - 1;
+    std::array<ExpectimaxStats, 4> stats;
+    std::array<std::future<double>, 4> scores;
+    for(int i = 0; i < 4; ++i) {
+        if(!successors.is_legal(static_cast<ShiftDirection>(i))) {
+            continue;
+        }
+        scores[i] = m_pool->submit([this, &successors, &stats, depth, i]() {
+            return expect_chance(successors.boards[i],
+                    depth,
+                    1.0,
+                    m_min_score,
+                    m_max_score,
+                    stats[i]);
+        });
+    }
+
+    bool found = false;
+    for(int i = 0; i < 4; ++i) {
+        if(!scores[i].valid()) {
+            continue;
+        }
+        double score = scores[i].get();
+        m_stats.move_nodes += 1;
+        add_counts(m_stats, stats[i]);
+        if(!found || score > m_stats.best_score) {
+            m_stats.best_score = score;
+            move = static_cast<ShiftDirection>(i);
+            found = true;
+        }
+    }
+    return found;
+}
+
+bool ExpectimaxController::stealing_best_move(
+        PackedBoard board, ShiftDirection& move) {
+    m_scheduler->reset_stats();
+    auto successors = board.successors();
+    std::array<SearchTask, 4> tasks;
+    m_scheduler->run([&]() {
+        WorkStealingPool::TaskGroup group;
+        for(int i = 0; i < 4; ++i) {
+            if(!successors.is_legal(static_cast<ShiftDirection>(i))) {
+                continue;
+            }
+            tasks[i].controller = this;
+            tasks[i].board = successors.boards[i];
+            tasks[i].depth = m_stats.depth - 1;
+            tasks[i].is_chance = true;
+            m_scheduler->spawn(group, tasks[i]);
+        }
+        m_scheduler->wait(group);
+    });
+
+    bool found = false;
+    for(int i = 0; i < 4; ++i) {
+        if(tasks[i].controller == nullptr) {
+            continue;
+        }
+        m_stats.move_nodes += 1;
+        add_counts(m_stats, tasks[i].stats);
+        if(!found || tasks[i].value > m_stats.best_score) {
+            m_stats.best_score = tasks[i].value;
+            move = static_cast<ShiftDirection>(i);
+            found = true;
+        }
+    }
+    return found;
+}
+
+int ExpectimaxController::search_depth(PackedBoard board) const {
+    if(m_options.depth > 0) {
+        return m_options.depth;
+    }
+    uint16_t exponents = 0;
+    for(int i = 0; i < PackedBoard::TOTAL_BLOCKS; ++i) {
+        exponents |= 1 << board.get_exponent(i);
+    }
+    // The empty cells show up as exponent 0.
+    int distinct = __builtin_popcount(exponents & ~1);
+    return std::clamp(distinct - 2, MIN_ADAPTIVE_DEPTH, MAX_ADAPTIVE_DEPTH);
+}
+
+double ExpectimaxController::expect_max(PackedBoard board,
+        int depth,
+        double probability,
+        double alpha,
+        double beta,
+        ExpectimaxStats& stats) {
+    auto successors = board.successors();
+    if(successors.legal_mask == 0) {
+        // A lost board scores the minimum of 0.
+        return 0.0;
+    }
+    double best = m_min_score;
+    for(int i = 0; i < 4; ++i) {
+        if(!successors.is_legal(static_cast<ShiftDirection>(i))) {
+            continue;
+        }
+        stats.move_nodes += 1;
+        best = std::max(best,
+                expect_chance(successors.boards[i],
+                        depth,
+                        probability,
+                        std::max(alpha, best),
+                        beta,
+                        stats));
+        if(best >= beta) {
+            break;
+        }
+    }
+    return best;
+}
+
+double ExpectimaxController::probe_max(
+        PackedBoard board,
+        int depth,
+        double probability,
+        double beta,
+        ExpectimaxStats& stats) {
+    auto successors = board.successors();
+    if(successors.legal_mask == 0) {
+        return 0.0;
+    }
+    int i = __builtin_ctz(successors.legal_mask);
+    stats.move_nodes += 1;
+    // With the window starting at the lowest score the search can not fail
+    // low, so the result is the move's value or a lower bound on it.
+    return expect_chance(successors.boards[i],
+            depth,
+            probability,
+            m_min_score,
+            beta,
+            stats);
+}
+
+double ExpectimaxController::expect_chance(PackedBoard board,
+        int depth,
+        double probability,
+        double alpha,
+        double beta,
+        ExpectimaxStats& stats) {
+    if(depth <= 0) {
+        stats.evaluations += 1;
+        return m_evaluator.evaluate(board);
+    }
+    if(probability < m_options.min_probability) {
+        stats.probability_cutoffs += 1;
+        stats.evaluations += 1;
+        return m_evaluator.evaluate(board);
+    }
+
+    // Every empty cell is equally likely to receive the new tile.
+    auto free = board.free_mask();
+    if(free == 0) {
+        stats.evaluations += 1;
+        return m_evaluator.evaluate(board);
+    }
+    // The children live in the arena of the thread searching this node
+    // until it returns, sized for the spawns of this board.
+    int cells = __builtin_popcount(free);
+    int count = 0;
+    auto& allocator = BoardAllocator::local();
+    BoardAllocator::Scope scope(allocator);
+    auto* children = allocator.allocate<PackedBoard>(2 * cells);
+    auto* weights = allocator.allocate<double>(2 * cells);
+    for(auto mask = free; mask != 0; mask &= mask - 1) {
+        int idx = __builtin_ctz(mask);
+        children[count] = board;
+        children[count].set_exponent(idx, 1);
+        weights[count++] = TWO_PROBABILITY / cells;
+        children[count] = board;
+        children[count].set_exponent(idx, 2);
+        weights[count++] = FOUR_PROBABILITY / cells;
+    }
+    stats.chance_nodes += count;
+
+    if(m_scheduler && depth >= m_options.split_depth) {
+        return split_chance(children,
+                weights,
+                count,
+                depth,
+                probability,
+                stats);
+    }
+
+    if(m_options.chance_pruning == ChancePruning::None) {
+        double total = 0.0;
+        for(int i = 0; i < count; ++i) {
+            total += weights[i] * expect_max(children[i],
+                                          depth - 1,
+                                          probability * weights[i],
+                                          m_min_score,
+                                          m_max_score,
+                                          stats);
+        }
+        return total;
+    }
+
+    // Lower bounds on each child, the worst score unless probed. The sum
+    // always holds the weighted bounds of the children.
+    auto* lower = allocator.allocate<double>(count);
+    std::fill(lower, lower + count, m_min_score);
+    double lower_total = m_min_score;
+    if(m_options.chance_pruning == ChancePruning::Star2) {
+        for(int i = 0; i < count; ++i) {
+            double others = lower_total - weights[i] * lower[i];
+            double child_beta = (beta - others) / weights[i];
+            if(child_beta > m_max_score) {
+                // Even the best score for this child would not cut.
+                continue;
+            }
+            lower[i] = probe_max(children[i],
+                    depth - 1,
+                    probability * weights[i],
+                    child_beta,
+                    stats);
+            lower_total = others + weights[i] * lower[i];
+            if(lower_total >= beta) {
+                stats.probe_cutoffs += 1;
+                return lower_total;
+            }
+        }
+    }
+
+    // Star1: the children left to search are between their lower bound
+    // and the best score, which bounds the value of the node. Each child is
+    // searched with the window that keeps those bounds inside alpha to
+    // beta.
+    double total = 0.0;
+    double lower_rest = lower_total;
+    double upper_rest = m_max_score;
+    for(int i = 0; i < count; ++i) {
+        lower_rest -= weights[i] * lower[i];
+        upper_rest -= weights[i] * m_max_score;
+        double child_alpha = (alpha - total - upper_rest) / weights[i];
+        double child_beta = (beta - total - lower_rest) / weights[i];
+        double value = expect_max(children[i],
+                depth - 1,
+                probability * weights[i],
+                std::max(child_alpha, lower[i]),
+                std::min(child_beta, m_max_score),
+                stats);
+        total += weights[i] * value;
+        if(value <= child_alpha) {
+            stats.chance_cutoffs += 1;
+            return total + upper_rest;
+        }
+        if(value >= child_beta) {
+            stats.chance_cutoffs += 1;
+            return total + lower_rest;
+        }
+    }
+    return total;
+}
+
+double ExpectimaxController::split_chance(const PackedBoard* children,
+        const double* weights,
+        int count,
+        int depth,
+        double probability,
+        ExpectimaxStats& stats) {
+    std::array<SearchTask, 2 * PackedBoard::TOTAL_BLOCKS> tasks;
+    WorkStealingPool::TaskGroup group;
+    for(int i = 0; i < count; ++i) {
+        tasks[i].controller = this;
+        tasks[i].board = children[i];
+        tasks[i].depth = depth - 1;
+        tasks[i].probability = probability * weights[i];
+        m_scheduler->spawn(group, tasks[i]);
+    }
+    m_scheduler->wait(group);
+
+    double total = 0.0;
+    for(int i = 0; i < count; ++i) {
+        total += weights[i] * tasks[i].value;
+        add_counts(stats, tasks[i].stats);
+    }
+    return total;
+}
+
+void ExpectimaxController::draw_state(
+        const Board& board, const GameTime& time) {
+    ImGui::Begin("Controller State");
+    ImGui::BulletText("Depth: %d", m_stats.depth);
+    ImGui::BulletText("Move Nodes: %lld",
+            static_cast<long long>(m_stats.move_nodes));
+    ImGui::BulletText("Chance Nodes: %lld",
+            static_cast<long long>(m_stats.chance_nodes));
+    ImGui::BulletText("Evaluations: %lld",
+            static_cast<long long>(m_stats.evaluations));
+    ImGui::BulletText("Probability Cutoffs: %lld",
+            static_cast<long long>(m_stats.probability_cutoffs));
+    ImGui::BulletText("Chance Cutoffs: %lld",
+            static_cast<long long>(m_stats.chance_cutoffs));
+    ImGui::BulletText("Probe Cutoffs: %lld",
+            static_cast<long long>(m_stats.probe_cutoffs));
+    ImGui::BulletText("Expected Score: %f", m_stats.best_score);
+    if(m_scheduler) {
+        auto scheduler_stats = m_scheduler->stats();
+        ImGui::BulletText("Tasks: %lld",
+                static_cast<long long>(scheduler_stats.tasks));
+        ImGui::BulletText("Steals: %lld",
+                static_cast<long long>(scheduler_stats.steals));
+        auto idle_str = format_duration(scheduler_stats.idle);
+        ImGui::BulletText("Worker Idle Time: %s", idle_str.c_str());
+    }
+    auto time_str = format_duration(m_move_time);
+    ImGui::BulletText("Time per Move: %s", time_str.c_str());
+    ImGui::End();
+}
@@ -0,0 +1,127 @@
+#ifndef EXPECTIMAXCONTROLLER_H_
+#define EXPECTIMAXCONTROLLER_H_
+
+#include "AiController.h"
+#include "Board.h"
+#include "PackedBoard.h"
+#include "SearchOptions.h"
+#include "TableEvaluator.h"
+#include "ThreadPool.h"
+#include "WorkStealingPool.h"
+
+#include <chrono>
+#include <memory>
+
+struct ExpectimaxStats {
+    // Positions reached by a move.
+    int64_t move_nodes = 0;
+    // Positions reached by a tile spawn.
+    int64_t chance_nodes = 0;
+    int64_t evaluations = 0;
+    // Chance nodes scored statically because they were too unlikely.
+    int64_t probability_cutoffs = 0;
+    // Chance nodes cut off by Star1, and by the probes of Star2.
+    int64_t chance_cutoffs = 0;
+    int64_t probe_cutoffs = 0;
+    double best_score = 0.0;
+    int depth = 0;
+};
+
+// Searches moves with expectimax: the player picks the best move, and tile
+// spawns are averaged over every empty cell, with a 2 or a 4 weighted by
+// their real probabilities. The search runs on PackedBoard with the table
+// kernels and scores leaves with a TableEvaluator.
+//
+// Branches that need an unlikely run of spawns are cut off once their
+// probability falls below SearchOptions::min_probability. Unless a fixed
+// depth is set, the depth grows with the number of distinct tiles, since
+// boards with many different tiles are the ones where a mistake is fatal.
+//
+// Chance nodes are pruned with Star1 or Star2, which use the bounds of the
+// evaluator to stop averaging spawns once the result can no longer change
+// the move. Pruned nodes return a bound instead of their value, but the
+// move picked is the same as without pruning.
+//
+// With more than one thread in SearchOptions, the moves at the root are
+// searched in parallel, each on a worker of a thread pool. With a split
+// depth as well, every chance node at least that far from the leaves
+// spawns its spawns as tasks on a work stealing pool. Those nodes give up
+// Star1, since their children are searched at the same time.
+class ExpectimaxController : public AiController {
+public:
+    static constexpr int MIN_ADAPTIVE_DEPTH = 3;
+    static constexpr int MAX_ADAPTIVE_DEPTH = 5;
+
+    ExpectimaxController(uint64_t seed = 0, const SearchOptions& options = {});
+    virtual ~ExpectimaxController() = default;
+
+    ExpectimaxController(const ExpectimaxController& other) = delete;
+    ExpectimaxController(ExpectimaxController&& other) noexcept = default;
+    ExpectimaxController& operator=(const ExpectimaxController& other) = delete;
+    ExpectimaxController& operator=(
+            ExpectimaxController&& other) noexcept = default;
+
+    virtual void do_turn(Board& board, const GameTime& time) override;
+    virtual void draw_state(const Board& board, const GameTime& time) override;
+
+    // Sets move to the best move from board. Returns false if no move is
+    // legal.
+    bool best_move(PackedBoard board, ShiftDirection& move);
+    // The depth searched from board.
+    int search_depth(PackedBoard board) const;
+
+    const ExpectimaxStats& stats() const { return m_stats; }
+    // Null unless the search uses work stealing.
+    const WorkStealingPool* scheduler() const { return m_scheduler.get(); }
+
+private:
+    // probability is the chance of reaching board from the root. If the
+    // value is outside the window alpha to beta, the result is only a bound
+    // on the value that is outside the window as well.
+    double expect_max(PackedBoard board,
+            int depth,
+            double probability,
+            double alpha,
+            double beta,
+            ExpectimaxStats& stats);
+    double expect_chance(PackedBoard board,
+            int depth,
+            double probability,
+            double alpha,
+            double beta,
+            ExpectimaxStats& stats);
+    // Returns a lower bound on the value of the move node board by
+    // searching only its first legal move.
+    double probe_max(PackedBoard board,
+            int depth,
+            double probability,
+            double beta,
+            ExpectimaxStats& stats);
+    // Searches the moves of board on the thread pool.
+    bool parallel_best_move(PackedBoard board, ShiftDirection& move);
+    // Searches the moves of board as tasks of the work stealing pool.
+    bool stealing_best_move(PackedBoard board, ShiftDirection& move);
+
+    // Searches one child of a split node.
+    struct SearchTask;
+    // Returns the weighted average of the values of the children, each
+    // searched as a task.
+    double split_chance(const PackedBoard* children,
+            const double* weights,
+            int count,
+            int depth,
+            double probability,
+            ExpectimaxStats& stats);
+
+    TableEvaluator m_evaluator;
+    // Bounds on the value of every node, including lost boards.
+    double m_min_score;
+    double m_max_score;
+    SearchOptions m_options;
+    ExpectimaxStats m_stats;
+    std::unique_ptr<ThreadPool> m_pool;
+    std::unique_ptr<WorkStealingPool> m_scheduler;
+    std::chrono::duration<double> m_move_time{0.0};
+};
+
+#endif
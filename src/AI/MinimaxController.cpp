@@ -1,25 +1,11 @@
 #include "MinimaxController.h"
 
+#include <algorithm>
 #include <iostream>
 
 #include <imgui/imgui.h>
 
-static constexpr double high_matrix[] = {0.20,
-        0.00,
-        0.00,
-        0.00,
-        0.40,
-        0.10,
-        0.00,
-        0.00,
-        0.65,
-        0.40,
-        0.10,
-        0.00,
-        1.00,
-        0.65,
-        0.40,
-        0.20};
+#include "TableEvaluator.h"
 
 std::string format_duration(std::chrono::duration<double> dt) {
     if(dt.count() < 1e-6) {
@@ -33,34 +19,76 @@ std::string format_duration(std::chrono::duration<double> dt) {
     }
 }
 
-double powi(double base, int pow) {
-    double out = base;
-    for(int i = 1; i < pow; ++i) {
-        out *= base;
+MinimaxController::MinimaxController(
+        uint64_t seed, const SearchOptions& options)
+        : MinimaxController(seed, options, nullptr) {}
+
+MinimaxController::MinimaxController(uint64_t seed,
+        const SearchOptions& options,
+        std::unique_ptr<Evaluator> evaluator)
+        : AiController(seed),
+          m_evaluator(std::move(evaluator)),
+          m_options(options),
+          m_table(options.table_megabytes,
+                  options.replacement,
+                  options.huge_pages) {
+    if(!m_evaluator) {
+        EvaluatorWeights weights;
+        weights.corner = 0.15;
+        m_evaluator = std::make_unique<TableEvaluator>(weights);
+    }
+    m_symmetric_keys = m_evaluator->is_symmetric();
+    if(options.threads > 1) {
+        m_pool = std::make_unique<ThreadPool>(options.threads);
     }
-    return out;
 }
 
 void MinimaxController::do_turn(Board& board, const GameTime& time) {
-    auto start = std::chrono::high_resolution_clock::now();
     if(board.is_lost()) {
         return;
     }
-    MinimaxStats stats;
-    auto [maybe_move, score] = iterative_deepen(board, 0, 6, stats);
+    board.do_move(best_move(board));
+}
 
-    board.do_move(static_cast<ShiftDirection>(maybe_move));
+ShiftDirection MinimaxController::best_move(const Board& board) {
+    auto start = std::chrono::high_resolution_clock::now();
+    MinimaxStats stats;
+    if(m_options.keep_table) {
+        m_table.new_search();
+    } else {
+        m_table.clear();
+    }
+    for(auto& history : m_history) {
+        history.store(history.load(std::memory_order_relaxed) / 2,
+                std::memory_order_relaxed);
+    }
+    int max_depth = DEFAULT_DEPTH;
+    if(m_options.depth > 0) {
+        max_depth = std::min(m_options.depth, MAX_TIMED_DEPTH);
+    } else if(m_options.time_per_move.count() > 0.0) {
+        max_depth = MAX_TIMED_DEPTH;
+    }
+    auto [maybe_move, score] = iterative_deepen(board, 0, max_depth, stats);
     m_stats = stats;
 
     auto end = std::chrono::high_resolution_clock::now();
-    m_time_per_node = (end - start) / stats.nodes_evaluated;
+    // The table can answer the whole search without visiting a node.
+    m_time_per_node = (end - start) / std::max(stats.nodes_evaluated, 1);
+    return static_cast<ShiftDirection>(maybe_move);
 }
 
 std::tuple<MaybeMove, double> MinimaxController::minimax(
         Board& board, int depth, MinimaxStats& stats) {
+    if(m_pool && depth > 0) {
+        return parallel_minimax_max(board,
+                depth,
+                std::numeric_limits<double>::lowest(),
+                std::numeric_limits<double>::max(),
+                stats);
+    }
     return minimax_max(board,
             depth,
-            std::numeric_limits<double>::min(),
+            std::numeric_limits<double>::lowest(),
             std::numeric_limits<double>::max(),
             stats);
 }
@@ -69,65 +97,61 @@ double MinimaxController::score_board(const Board& board) {
     if(board.is_lost()) {
         return 0.0;
     }
-    auto free = board.free_spaces();
-    auto max_val = board.max_value();
-
-    auto score = 0.0;
-    auto board_score = board.compute_score();
-    // score += 0.55*board.monotonic_score();
-    score += board_score;
+    return m_evaluator->evaluate(board);
+}
 
-    score *= powi(1.05, free);
-    // score *= 1.0 + 0.2*fast_pow2_log2(max_val);
-    /*
-    if(free == 0) {
-        score *= 0.10;
-    } else if(free == 1) {
-        score *= 0.50;
-    } else if(free == 2) {
-        score *= 0.66;
+std::tuple<MaybeMove, double> MinimaxController::minimax_max(Board& board,
+        int depth,
+        double alpha,
+        double beta,
+        MinimaxStats& stats) {
+    if(out_of_time()) {
+        return std::tuple(MaybeMove::Left, alpha);
     }
-    */
-
-    double high_edges_score = 0.0;
-    double low_edges_score = 1.0;
-    for(int i = 0; i < board.total_blocks(); ++i) {
-        auto& cell = board.get_cell(i);
-        if(cell.value == max_val) {
-            high_edges_score += high_matrix[i];
-        } else if(cell.value == (max_val >> 1)) {
-            high_edges_score += 0.5 * high_matrix[i];
+    auto [key, symmetry] = table_key(board);
+    int8_t table_move = -1;
+    TTEntry entry;
+    if(m_table.probe(key, entry)) {
+        if(entry.best_move >= 0) {
+            table_move = static_cast<int8_t>(apply_symmetry(
+                    static_cast<ShiftDirection>(entry.best_move),
+                    inverse(symmetry)));
         }
-        int low_cutoff = fast_pow2_log2(max_val) - 3;
-        for(int i = 1; i < low_cutoff; ++i) {
-            low_edges_score += (low_cutoff - i) * high_matrix[i];
+        if(is_cutoff(entry, depth, alpha, beta)) {
+            stats.table_hits += 1;
+            auto dir = table_move >= 0 ? static_cast<MaybeMove>(table_move)
+                                       : MaybeMove::Left;
+            return std::tuple(dir, entry.score);
         }
     }
 
-    score *= 1.0 + 0.15 * high_edges_score;
+    std::array<int, 4> order;
+    order_moves(table_move, order);
 
-    return score;
-}
+    auto successors = board.successors();
+    if(successors.legal_mask == 0) {
+        // Lost, which scores the same as in score_board.
+        stats.nodes_evaluated += 1;
+        return std::tuple(MaybeMove::Left, 0.0);
+    }
 
-std::tuple<MaybeMove, double> MinimaxController::minimax_max(Board& board,
-        int depth,
-        double alpha,
-        double beta,
-        MinimaxStats& stats) {
-    double max_score = alpha; // std::numeric_limits<double>::min();
+    double max_score = alpha;
     ShiftDirection max_dir = ShiftDirection::Left;
-    for(int i = 0; i < 4; ++i) {
+    int8_t best_move = -1;
+    for(int i : order) {
         auto dir = static_cast<ShiftDirection>(i);
-        Board board_copy = board;
-        auto works = board_copy.shift_board(dir);
         stats.nodes_evaluated += 1;
-        if(!works) {
+        if(!successors.is_legal(dir)) {
             continue;
         }
+        Board& board_copy = successors.boards[i];
 
         double score;
         if(depth > 0) {
             score = minimax_min(board_copy, depth - 1, max_score, beta, stats);
+            if(m_aborted) {
+                return std::tuple(static_cast<MaybeMove>(max_dir), max_score);
+            }
         } else {
             score = score_board(board_copy);
         }
@@ -136,12 +160,102 @@ std::tuple<MaybeMove, double> MinimaxController::minimax_max(Board& board,
         if(score > max_score) {
             max_score = score;
             max_dir = dir;
+            best_move = static_cast<int8_t>(i);
         }
         if(max_score > beta) {
             stats.nodes_pruned += 1;
             break;
         }
     }
+    if(best_move >= 0) {
+        m_history[best_move].fetch_add(
+                (depth + 1) * (depth + 1), std::memory_order_relaxed);
+    }
+
+    // Scores are clamped to the window, so a score on its edge is only a
+    // bound. A search with an empty window says nothing about the position.
+    if(alpha < beta) {
+        auto bound = Bound::Exact;
+        if(best_move < 0) {
+            bound = Bound::Upper;
+        } else if(max_score >= beta) {
+            bound = Bound::Lower;
+        }
+        if(best_move >= 0) {
+            best_move = static_cast<int8_t>(apply_symmetry(
+                    static_cast<ShiftDirection>(best_move), symmetry));
+        }
+        m_table.store(key, depth, max_score, bound, best_move);
+    }
+
+    stats.max_score = std::max(stats.max_score, max_score);
+    return std::tuple(static_cast<MaybeMove>(max_dir), max_score);
+}
+
+std::tuple<MaybeMove, double> MinimaxController::parallel_minimax_max(
+        Board& board,
+        int depth,
+        double alpha,
+        double beta,
+        MinimaxStats& stats) {
+    // The moves are searched at once, so each gets the whole window instead
+    // of the one narrowed by the moves before it. They still share the
+    // transposition table.
+    auto successors = board.successors();
+    std::array<MinimaxStats, 4> move_stats;
+    std::array<std::future<double>, 4> scores;
+    for(int i = 0; i < 4; ++i) {
+        stats.nodes_evaluated += 1;
+        if(!successors.is_legal(static_cast<ShiftDirection>(i))) {
+            continue;
+        }
+        scores[i] = m_pool->submit(
+                [this, &successors, &move_stats, depth, alpha, beta, i]() {
+                    return minimax_min(successors.boards[i],
+                            depth - 1,
+                            alpha,
+                            beta,
+                            move_stats[i]);
+                });
+    }
+
+    double max_score = alpha;
+    ShiftDirection max_dir = ShiftDirection::Left;
+    int8_t best_move = -1;
+    for(int i = 0; i < 4; ++i) {
+        if(!scores[i].valid()) {
+            continue;
+        }
+        auto dir = static_cast<ShiftDirection>(i);
+        double score = scores[i].get() * score_move(dir);
+        stats.nodes_evaluated += move_stats[i].nodes_evaluated;
+        stats.nodes_pruned += move_stats[i].nodes_pruned;
+        stats.table_hits += move_stats[i].table_hits;
+        stats.max_score = std::max(stats.max_score, move_stats[i].max_score);
+        if(score > max_score) {
+            max_score = score;
+            max_dir = dir;
+            best_move = static_cast<int8_t>(i);
+        }
+    }
+    if(m_aborted) {
+        return std::tuple(static_cast<MaybeMove>(max_dir), max_score);
+    }
+
+    if(alpha < beta) {
+        auto bound = Bound::Exact;
+        if(best_move < 0) {
+            bound = Bound::Upper;
+        } else if(max_score >= beta) {
+            bound = Bound::Lower;
+        }
+        auto [key, symmetry] = table_key(board);
+        if(best_move >= 0) {
+            best_move = static_cast<int8_t>(apply_symmetry(
+                    static_cast<ShiftDirection>(best_move), symmetry));
+        }
+        m_table.store(key, depth, max_score, bound, best_move);
+    }
     stats.max_score = std::max(stats.max_score, max_score);
     return std::tuple(static_cast<MaybeMove>(max_dir), max_score);
 }
@@ -151,46 +265,161 @@ double MinimaxController::minimax_min(Board& board,
         double alpha,
         double beta,
         MinimaxStats& stats) {
-    double max_score = beta; // std::numeric_limits<double>::min();
-    int max_idx = 0;
+    // Chance positions are keyed apart from move positions, since the same
+    // board can be reached both before and after a spawn.
+    auto key = std::get<0>(table_key(board)) ^ MIN_NODE_KEY;
+    TTEntry entry;
+    if(m_table.probe(key, entry) && is_cutoff(entry, depth, alpha, beta)) {
+        stats.table_hits += 1;
+        return entry.score;
+    }
 
+    // The spawns as the score after them and the cell and tile, 2 << j, as
+    // 2 * i + j. The spawn that hurts the player most is the one most
+    // likely to cut, so with ordering they are searched worst first.
+    std::array<std::pair<double, int>, 2 * Board::total_blocks()> spawns;
+    int count = 0;
     for(int j = 0; j < 2; ++j) {
-        for(int i = 0; i < board.total_blocks(); ++i) {
-            auto cell = board.get_cell(i);
-            if(!cell.is_empty()) {
-                continue;
-            }
+        for(auto free = board.free_mask(); free != 0; free &= free - 1) {
+            spawns[count++] = {0.0, 2 * __builtin_ctzll(free) + j};
+        }
+    }
+    if(m_options.move_ordering && depth >= SPAWN_SORT_DEPTH) {
+        for(int k = 0; k < count; ++k) {
             Board board_copy = board;
-            board_copy.get_cell(i) = Cell(2 << j);
-            stats.nodes_evaluated += 1;
-
-            auto score = 0.0;
-            if(depth > 0) {
-                auto [move, out_score] = minimax_max(
-                        board_copy, depth - 1, alpha, max_score, stats);
-                score = out_score;
-            } else {
-                score = score_board(board_copy);
-            }
+            board_copy.set_cell(
+                    spawns[k].second / 2, Cell(2 << (spawns[k].second % 2)));
+            spawns[k].first = score_board(board_copy);
+        }
+        std::sort(spawns.begin(),
+                spawns.begin() + count,
+                [](const auto& lhs, const auto& rhs) {
+                    return lhs.first < rhs.first;
+                });
+    }
+    if(m_options.move_ordering) {
+        int killer = m_killer_spawns[depth].load(std::memory_order_relaxed);
+        auto end = spawns.begin() + count;
+        auto it = std::find_if(spawns.begin(), end,
+                [killer](const auto& spawn) { return spawn.second == killer; });
+        if(it != end) {
+            std::rotate(spawns.begin(), it, it + 1);
+        }
+    }
 
-            if(score < max_score) {
-                max_score = score;
-                max_idx = i;
-            }
+    double max_score = beta;
+    int max_idx = -1;
+    int max_spawn = -1;
+    for(int k = 0; k < count; ++k) {
+        int i = spawns[k].second / 2;
+        int j = spawns[k].second % 2;
+        Board board_copy = board;
+        board_copy.set_cell(i, Cell(2 << j));
+        stats.nodes_evaluated += 1;
 
-            if(max_score < alpha) {
-                stats.nodes_pruned += 1;
+        auto score = 0.0;
+        if(depth > 0) {
+            auto [move, out_score] = minimax_max(
+                    board_copy, depth - 1, alpha, max_score, stats);
+            if(m_aborted) {
                 return max_score;
             }
+            score = out_score;
+        } else {
+            score = score_board(board_copy);
+        }
+
+        if(score < max_score) {
+            max_score = score;
+            max_idx = i;
+            max_spawn = spawns[k].second;
+        }
+
+        if(max_score < alpha) {
+            stats.nodes_pruned += 1;
+            m_killer_spawns[depth].store(max_spawn, std::memory_order_relaxed);
+            m_table.store(key, depth, max_score, Bound::Upper, -1);
+            return max_score;
+        }
+    }
+    if(alpha < beta) {
+        auto bound = Bound::Exact;
+        if(max_idx < 0) {
+            bound = Bound::Lower;
+        } else if(max_score <= alpha) {
+            bound = Bound::Upper;
         }
+        m_table.store(key, depth, max_score, bound, -1);
     }
     return max_score;
 }
 
+std::tuple<uint64_t, Symmetry> MinimaxController::table_key(
+        const Board& board) const {
+    if(m_symmetric_keys && PackedBoard::can_pack(board)) {
+        // The packed cells identify the board exactly, and mixing them
+        // spreads them over the buckets like the Zobrist hash does.
+        auto canonical = canonicalize(PackedBoard(board.packed_bits()));
+        return std::tuple(mix64(canonical.board.bits()), canonical.transform);
+    }
+    return std::tuple(board.hash(), Symmetry::Identity);
+}
+
+bool MinimaxController::is_cutoff(
+        const TTEntry& entry, int depth, double alpha, double beta) {
+    if(entry.depth < depth) {
+        return false;
+    }
+    switch(entry.bound) {
+    case Bound::Exact:
+        return true;
+    case Bound::Lower:
+        return entry.score >= beta;
+    case Bound::Upper:
+        return entry.score <= alpha;
+    }
+    return false;
+}
+
+void MinimaxController::order_moves(
+        int8_t table_move, std::array<int, 4>& order) const {
+    order = {0, 1, 2, 3};
+    if(m_options.move_ordering) {
+        std::array<uint32_t, 4> history;
+        for(int i = 0; i < 4; ++i) {
+            history[i] = m_history[i].load(std::memory_order_relaxed);
+        }
+        // An insertion sort, which keeps ties in direction order.
+        for(int i = 1; i < 4; ++i) {
+            for(int j = i; j > 0 && history[order[j]] > history[order[j - 1]];
+                    --j) {
+                std::swap(order[j], order[j - 1]);
+            }
+        }
+    }
+    // The best move of an earlier, shallower search is likely still the
+    // best, and searching it first gives the tightest window for the rest.
+    if(table_move >= 0) {
+        auto it = std::find(order.begin(), order.end(), table_move);
+        std::rotate(order.begin(), it, it + 1);
+    }
+}
+
 void MinimaxController::draw_state(const Board& board, const GameTime& time) {
     ImGui::Begin("Controller State");
+    ImGui::BulletText("Depth: %d", m_stats.depth);
+    ImGui::BulletText("Aborted Searches: %d", m_stats.aborted);
     ImGui::BulletText("Nodes Evaluated: %d", m_stats.nodes_evaluated);
     ImGui::BulletText("Nodes Pruned: %d", m_stats.nodes_pruned);
+    ImGui::BulletText("Table Hits: %d", m_stats.table_hits);
+    auto counters = m_table.counters();
+    ImGui::BulletText("Table Probe Hits: %llu / %llu",
+            static_cast<unsigned long long>(counters.hits),
+            static_cast<unsigned long long>(counters.probes));
+    ImGui::BulletText("Table Collisions: %llu",
+            static_cast<unsigned long long>(counters.collisions));
+    ImGui::BulletText("Table Overwrites: %llu",
+            static_cast<unsigned long long>(counters.overwrites));
     ImGui::BulletText("Prune Ratio: %f%%",
             100.0 * static_cast<double>(m_stats.nodes_pruned) /
                     (m_stats.nodes_pruned + m_stats.nodes_evaluated));
@@ -211,17 +440,85 @@ double MinimaxController::score_move(ShiftDirection dir) {
 }
 
 std::tuple<MaybeMove, double> MinimaxController::iterative_deepen(
-        Board& board, int start, int end, MinimaxStats& stats) {
-    double max_score = 0.0;
+        const Board& board, int start, int end, MinimaxStats& stats) {
+    auto start_time = std::chrono::high_resolution_clock::now();
+    auto budget = m_options.time_per_move;
+    m_has_deadline = false;
+    m_aborted = false;
+
+    // The result of the deepest iteration that finished. The first one
+    // always does, since it runs without a deadline.
+    double best_score = std::numeric_limits<double>::lowest();
     MaybeMove dir = MaybeMove::Left;
-    for(int i = start; i <= end; i += 2) {
+    int last_nodes = 0;
+    auto last_iteration_nodes = m_iteration_nodes;
+    m_iteration_nodes = {};
+    // Iterations step by a move and a spawn, but the last one always
+    // searches to end, so an odd depth keeps its final move.
+    for(int i = start; i <= end; i = i < end ? std::min(i + 2, end) : i + 1) {
+        if(budget.count() > 0.0 && i > start) {
+            // Predict the next iteration from the last one, grown by the
+            // branching factor, at the measured time per node. Iterations
+            // the table answers from the last move cost almost nothing and
+            // predict too little, so the same iteration of the last move is
+            // a floor. The measurements of the last move are kept until this
+            // one has visited enough nodes to measure them again.
+            std::chrono::duration<double> elapsed =
+                    std::chrono::high_resolution_clock::now() - start_time;
+            if(stats.nodes_evaluated >= TIME_CHECK_INTERVAL ||
+                    m_time_per_node.count() == 0.0) {
+                m_time_per_node = elapsed / std::max(stats.nodes_evaluated, 1);
+            }
+            double next_nodes = std::max(last_nodes * m_branching,
+                    static_cast<double>(last_iteration_nodes[i]));
+            auto predicted = m_time_per_node * next_nodes;
+            if(elapsed + predicted > budget) {
+                break;
+            }
+            // Only the first iteration is guaranteed to finish, so there is
+            // always a move.
+            m_has_deadline = true;
+            m_deadline = start_time +
+                         std::chrono::duration_cast<
+                                 std::chrono::high_resolution_clock::duration>(
+                                 budget);
+        }
+
+        int nodes_before = stats.nodes_evaluated;
         auto board_clone = board.clone();
         auto [move, score] = minimax(board_clone, i, stats);
-        if(score > max_score) {
-            max_score = score;
-            dir = move;
+        int nodes = stats.nodes_evaluated - nodes_before;
+        m_iteration_nodes[i] = nodes;
+        if(m_aborted) {
+            stats.aborted += 1;
+            break;
+        }
+        if(last_nodes >= TIME_CHECK_INTERVAL) {
+            m_branching = static_cast<double>(nodes) / last_nodes;
         }
+        last_nodes = nodes;
+        stats.depth = i;
+        // A deeper search sees more of the spawns, so it replaces the
+        // result even when it scores lower.
+        best_score = score;
+        dir = move;
     }
 
-    return std::tuple(dir, max_score);
+    m_has_deadline = false;
+    return std::tuple(dir, best_score);
+}
+
+bool MinimaxController::out_of_time() {
+    static thread_local int countdown = TIME_CHECK_INTERVAL;
+    if(!m_has_deadline) {
+        return false;
+    }
+    if(--countdown > 0) {
+        return m_aborted;
+    }
+    countdown = TIME_CHECK_INTERVAL;
+    if(std::chrono::high_resolution_clock::now() >= m_deadline) {
+        m_aborted = true;
+    }
+    return m_aborted;
 }
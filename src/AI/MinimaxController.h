@@ -3,8 +3,16 @@
 
 #include "AiController.h"
 #include "Board.h"
+#include "Evaluator.h"
+#include "SearchOptions.h"
+#include "Symmetry.h"
+#include "ThreadPool.h"
+#include "TranspositionTable.h"
 
+#include <array>
+#include <atomic>
 #include <limits>
+#include <memory>
 #include <random>
 
 enum class MaybeMove {
@@ -22,26 +30,42 @@ struct MinimaxResult {
 };
 
 struct MinimaxStats {
-    double max_score = std::numeric_limits<double>::min();
+    double max_score = std::numeric_limits<double>::lowest();
     int nodes_evaluated = 0;
     int nodes_pruned = 0;
+    // Nodes answered by the transposition table.
+    int table_hits = 0;
+    // The deepest search that finished.
+    int depth = 0;
+    // Searches abandoned when the time ran out.
+    int aborted = 0;
 };
 
 class MinimaxController : public AiController {
 public:
-    MinimaxController(uint64_t seed = 0) : AiController(seed) {}
+    MinimaxController(uint64_t seed = 0, const SearchOptions& options = {});
+    // Scores the leaves of the search with evaluator, or with the default
+    // TableEvaluator if it is null.
+    MinimaxController(uint64_t seed,
+            const SearchOptions& options,
+            std::unique_ptr<Evaluator> evaluator);
     ~MinimaxController() = default;
 
     MinimaxController(const MinimaxController& other) = delete;
-    MinimaxController(MinimaxController&& other) noexcept = default;
+    MinimaxController(MinimaxController&& other) noexcept = delete;
     MinimaxController& operator=(const MinimaxController& other) = delete;
-    MinimaxController& operator=(MinimaxController&& other) noexcept = default;
+    MinimaxController& operator=(MinimaxController&& other) noexcept = delete;
 
     virtual void do_turn(Board& board, const GameTime& time) override;
+    // Searches board and returns the move to make, without making it.
+    ShiftDirection best_move(const Board& board);
     virtual void seed(std::seed_seq& seed) override { m_rng.seed(seed); }
 
     virtual void draw_state(const Board& board, const GameTime& time) override;
 
+    // The stats of the last search.
+    const MinimaxStats& stats() const { return m_stats; }
+
 private:
     std::tuple<MaybeMove, double> minimax(Board& board,
             int depth,
@@ -57,14 +81,72 @@ private:
             double alpha,
             double beta,
             MinimaxStats& node_count);
+    // minimax_max with each move searched on a worker of the thread pool.
+    std::tuple<MaybeMove, double> parallel_minimax_max(Board& board,
+            int depth,
+            double alpha,
+            double beta,
+            MinimaxStats& node_count);
 
     std::tuple<MaybeMove, double> iterative_deepen(
-            Board& board, int start, int end, MinimaxStats& stats);
+            const Board& board, int start, int end, MinimaxStats& stats);
+
+    // Returns the key of board in the table, and the symmetry that maps
+    // board onto the position stored under it. Moves in the table are
+    // those of that position.
+    std::tuple<uint64_t, Symmetry> table_key(const Board& board) const;
+
+    // Fills order with the moves to search, the table move first and the
+    // rest by their history score.
+    void order_moves(int8_t table_move, std::array<int, 4>& order) const;
+
+    // Returns true if entry answers a search of depth with the window
+    // alpha to beta.
+    static bool is_cutoff(
+            const TTEntry& entry, int depth, double alpha, double beta);
+
+    // Returns true once the deadline of the move has passed. The clock is
+    // only read every TIME_CHECK_INTERVAL calls on each thread.
+    bool out_of_time();
 
     double score_board(const Board& board);
     double score_move(ShiftDirection dir);
 
-    std::chrono::duration<double> m_time_per_node;
+    static constexpr uint64_t MIN_NODE_KEY = 0x6A09E667F3BCC909ULL;
+    // The depth searched without a time limit, and the deepest searched
+    // with one or asked for in SearchOptions.
+    static constexpr int DEFAULT_DEPTH = 6;
+    static constexpr int MAX_TIMED_DEPTH = 20;
+    static constexpr int TIME_CHECK_INTERVAL = 1024;
+    // Chance nodes at least this deep sort their spawns by the evaluation
+    // after them. Shallower ones only try the killer spawn first, since
+    // their subtrees are too small to pay for the evaluations.
+    static constexpr int SPAWN_SORT_DEPTH = 3;
+
+    std::unique_ptr<Evaluator> m_evaluator;
+    SearchOptions m_options;
+    TranspositionTable m_table;
+    // Whether the symmetric images of a position share a table entry,
+    // which is only sound if the evaluator scores them the same.
+    bool m_symmetric_keys = false;
+    std::chrono::duration<double> m_time_per_node{0.0};
+    // How many times more nodes each iteration takes than the one before.
+    double m_branching = 0.0;
+    std::chrono::high_resolution_clock::time_point m_deadline;
+    bool m_has_deadline = false;
+    // Set once a search runs out of time, which unwinds it on every thread.
+    std::atomic<bool> m_aborted{false};
+    std::unique_ptr<ThreadPool> m_pool;
+    // How often each move was the best or caused a cutoff, weighted by the
+    // depth searched below it. Halved every move so that it follows the
+    // game. Shared between threads without synchronization, since it only
+    // affects the order.
+    std::array<std::atomic<uint32_t>, 4> m_history{};
+    // The spawn that last cut off a chance node, per depth.
+    std::array<std::atomic<int>, MAX_TIMED_DEPTH + 1> m_killer_spawns{};
+    // The nodes each iteration of the last search took, or took before it
+    // was abandoned.
+    std::array<int, MAX_TIMED_DEPTH + 1> m_iteration_nodes{};
     std::default_random_engine m_rng;
     MinimaxStats m_stats;
 };
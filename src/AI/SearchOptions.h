@@ -0,0 +1,59 @@
+#ifndef SEARCHOPTIONS_H_
+#define SEARCHOPTIONS_H_
+
+#include "TranspositionTable.h"
+
+#include <chrono>
+
+// How chance nodes of an expectimax search are cut off.
+enum class ChancePruning {
+    None = 0,
+    // Star1 stops searching the spawns of a chance node once the ones
+    // searched so far put its average outside the window, assuming the
+    // best or worst possible score for the rest.
+    Star1 = 1,
+    // Star2 first probes one move after every spawn for a lower bound
+    // before running Star1, which cuts nodes that are certain to fail high.
+    Star2 = 2,
+};
+
+// Settings shared by the search based controllers, filled in from the
+// command line.
+struct SearchOptions {
+    // How deep to search. Expectimax counts moves, including the one being
+    // made, Minimax counts plies, where a move and a spawn are one each. 0
+    // picks the depth for every move from the position.
+    int depth = 0;
+    // If not 0, iterative deepening stops once the next depth is not
+    // expected to finish within this time, and a search that runs over is
+    // abandoned. depth then only caps the search.
+    std::chrono::duration<double> time_per_move{0.0};
+    // Chance branches reached with a lower probability than this are
+    // scored by the evaluator instead of searched further.
+    double min_probability = 0.001;
+    ChancePruning chance_pruning = ChancePruning::Star1;
+    // The number of threads a search may use.
+    int threads = 1;
+    // If not 0 and there are several threads, expectimax chance nodes with
+    // at least this many moves left search their spawns as tasks on a work
+    // stealing pool. Otherwise only the root moves are split.
+    int split_depth = 0;
+    // Whether Minimax orders moves by the history heuristic and spawns by
+    // how bad they are for the player. The transposition table move is
+    // always searched first.
+    bool move_ordering = true;
+    // Whether the transposition table keeps its entries from one move to
+    // the next, so that a search starts from what the last one found out
+    // about the positions that are still reachable. Otherwise the table is
+    // emptied before every move. Since a kept table can answer an iteration
+    // with a result searched deeper for an earlier move, the chosen moves
+    // can differ.
+    bool keep_table = true;
+    // The size of the transposition table in MiB.
+    std::size_t table_megabytes = 16;
+    ReplacementPolicy replacement = ReplacementPolicy::DepthPreferred;
+    // Asks for the transposition table to be backed by huge pages.
+    bool huge_pages = false;
+};
+
+#endif
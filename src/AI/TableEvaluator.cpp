@@ -0,0 +1,190 @@
+#include "TableEvaluator.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+
+// How much each cell rewards holding the largest tile, favoring the bottom
+// left corner and the edges next to it.
+static constexpr double CORNER_MATRIX[] = {0.20,
+        0.00,
+        0.00,
+        0.00,
+        0.40,
+        0.10,
+        0.00,
+        0.00,
+        0.65,
+        0.40,
+        0.10,
+        0.00,
+        1.00,
+        0.65,
+        0.40,
+        0.20};
+
+// The sum of CORNER_MATRIX over the cells of a row picked by a 4 bit mask,
+// per row.
+using CornerRowTable = std::array<std::array<double, 16>, 4>;
+
+static constexpr CornerRowTable make_corner_rows() {
+    CornerRowTable rows = {};
+    for(int row = 0; row < 4; ++row) {
+        for(int mask = 0; mask < 16; ++mask) {
+            for(int col = 0; col < 4; ++col) {
+                if((mask >> col) & 1) {
+                    rows[row][mask] += CORNER_MATRIX[4 * row + col];
+                }
+            }
+        }
+    }
+    return rows;
+}
+
+static constexpr CornerRowTable CORNER_ROWS = make_corner_rows();
+
+// Returns a mask with bit 4i set if cell i of rows holds exponent.
+static uint64_t equal_cells(uint64_t rows, int exponent) {
+    constexpr uint64_t LOW_BITS = 0x1111111111111111ULL;
+    uint64_t diff = rows ^ (LOW_BITS * static_cast<uint64_t>(exponent));
+    return ~(diff | diff >> 1 | diff >> 2 | diff >> 3) & LOW_BITS;
+}
+
+// Sums the weights of the cells set in a mask from equal_cells.
+static double corner_weight(uint64_t cells) {
+    double weight = 0.0;
+    for(int row = 0; row < 4; ++row) {
+        uint64_t bits = cells >> (16 * row);
+        int mask = static_cast<int>(
+                (bits | bits >> 3 | bits >> 6 | bits >> 9) & 0xF);
+        weight += CORNER_ROWS[row][mask];
+    }
+    return weight;
+}
+
+TableEvaluator::TableEvaluator(const EvaluatorWeights& weights)
+        : m_weights(weights) {
+    m_cache = CachedTable::load("evaluator",
+            table_key(),
+            MoveTables::ROW_COUNT * sizeof(float),
+            [this](void* data, std::size_t) {
+                auto* scores = static_cast<float*>(data);
+                for(int i = 0; i < MoveTables::ROW_COUNT; ++i) {
+                    scores[i] = static_cast<float>(score_line(i));
+                }
+            });
+    m_line_scores = static_cast<const float*>(m_cache.data());
+
+    auto [min_line, max_line] = std::minmax_element(
+            m_line_scores, m_line_scores + MoveTables::ROW_COUNT);
+    m_min_score = 8.0 * *min_line;
+    m_max_score = 8.0 * *max_line;
+    if(m_weights.corner != 0.0) {
+        // The corner score is largest when every cell holds the largest
+        // tile.
+        double corner_max = 0.0;
+        for(double weight : CORNER_MATRIX) {
+            corner_max += weight;
+        }
+        double factor = 1.0 + m_weights.corner * corner_max;
+        double scaled[] = {m_min_score * factor, m_max_score * factor};
+        m_min_score = std::min({m_min_score, scaled[0], scaled[1]});
+        m_max_score = std::max({m_max_score, scaled[0], scaled[1]});
+    }
+}
+
+uint64_t TableEvaluator::table_key() const {
+    // The corner weight is applied after the lookups, so it is not part of
+    // the table.
+    const double line_weights[] = {m_weights.line_bonus,
+            m_weights.empty,
+            m_weights.merges,
+            m_weights.monotonicity,
+            m_weights.monotonicity_power,
+            m_weights.smoothness,
+            m_weights.sum,
+            m_weights.sum_power};
+    uint64_t key = mix64(VERSION);
+    for(double weight : line_weights) {
+        uint64_t bits;
+        std::memcpy(&bits, &weight, sizeof(bits));
+        key = mix64(key ^ bits);
+    }
+    return key;
+}
+
+double TableEvaluator::evaluate(const Board& board) const {
+    // Tiles past the largest packable value are scored as if they were
+    // 32768, which only happens at the very end of a game.
+    int max_exponent = 0;
+    if(board.max_value() != 0) {
+        max_exponent = std::min(__builtin_ctz(board.max_value()),
+                PackedBoard::MAX_EXPONENT);
+    }
+    return evaluate_rows(board.packed_bits(), max_exponent);
+}
+
+double TableEvaluator::score_line(uint16_t line) const {
+    int rank[4];
+    for(int i = 0; i < 4; ++i) {
+        rank[i] = (line >> (4 * i)) & 0xF;
+    }
+
+    double sum = 0.0;
+    int empty = 0;
+    for(int i = 0; i < 4; ++i) {
+        sum += std::pow(rank[i], m_weights.sum_power);
+        if(rank[i] == 0) {
+            empty += 1;
+        }
+    }
+
+    // Runs of equal tiles, ignoring the gaps between them, since a move
+    // closes the gaps before merging.
+    int merges = 0;
+    int prev = 0;
+    int run = 0;
+    for(int i = 0; i < 4; ++i) {
+        if(rank[i] == 0) {
+            continue;
+        }
+        if(rank[i] == prev) {
+            run += 1;
+        } else {
+            merges += run > 0 ? 1 + run : 0;
+            run = 0;
+        }
+        prev = rank[i];
+    }
+    merges += run > 0 ? 1 + run : 0;
+
+    double mono_left = 0.0;
+    double mono_right = 0.0;
+    double smoothness = 0.0;
+    for(int i = 1; i < 4; ++i) {
+        double lhs = std::pow(rank[i - 1], m_weights.monotonicity_power);
+        double rhs = std::pow(rank[i], m_weights.monotonicity_power);
+        if(rank[i - 1] > rank[i]) {
+            mono_left += lhs - rhs;
+        } else {
+            mono_right += rhs - lhs;
+        }
+        if(rank[i - 1] != 0 && rank[i] != 0) {
+            smoothness += std::abs(rank[i - 1] - rank[i]);
+        }
+    }
+
+    return m_weights.line_bonus + m_weights.empty * empty +
+           m_weights.merges * merges -
+           m_weights.monotonicity * std::min(mono_left, mono_right) -
+           m_weights.smoothness * smoothness - m_weights.sum * sum;
+}
+
+double TableEvaluator::corner_score(uint64_t rows, int max_exponent) {
+    double score = corner_weight(equal_cells(rows, max_exponent));
+    if(max_exponent > 1) {
+        score += 0.5 * corner_weight(equal_cells(rows, max_exponent - 1));
+    }
+    return score;
+}
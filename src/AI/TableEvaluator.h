@@ -0,0 +1,106 @@
+#ifndef TABLEEVALUATOR_H_
+#define TABLEEVALUATOR_H_
+
+#include "Evaluator.h"
+
+#include "PackedBoard.h"
+#include "TableCache.h"
+
+// The weights of the features scored for every row and column. Penalties
+// are subtracted, bonuses added.
+struct EvaluatorWeights {
+    // Added once per line so that scores stay positive.
+    double line_bonus = 200000.0;
+    double empty = 270.0;
+    // Pairs of equal tiles that can be merged by a move along the line.
+    double merges = 700.0;
+    // Penalty for tiles that go against the line's better direction.
+    double monotonicity = 47.0;
+    double monotonicity_power = 4.0;
+    // Penalty for the exponent differences of neighboring tiles.
+    double smoothness = 0.0;
+    // Penalty for large tiles anywhere, which favors merging.
+    double sum = 11.0;
+    double sum_power = 3.5;
+    // If not 0, the score is scaled by 1 + corner * c, where c is the
+    // corner weighting of the largest and second largest tiles. This is
+    // the only feature that needs the largest tile, which a PackedBoard
+    // has to scan for.
+    double corner = 0.0;
+};
+
+// Scores a board as the sum of precomputed scores of its 4 rows and 4
+// columns, so an evaluation is 8 table lookups and a transpose. A Board is
+// read through the packed cells and the largest tile it keeps up to date.
+//
+// The table is indexed by the packed 16 bit line. A column is scored as a
+// row of the transposed board, read from top to bottom. Tables are cached
+// on disk per set of weights, see CachedTable.
+class TableEvaluator : public Evaluator {
+public:
+    // Bumped whenever score_line changes, which invalidates the cache files.
+    static constexpr uint64_t VERSION = 1;
+
+    explicit TableEvaluator(const EvaluatorWeights& weights = {});
+    virtual ~TableEvaluator() = default;
+
+    TableEvaluator(const TableEvaluator& other) = default;
+    TableEvaluator(TableEvaluator&& other) noexcept = default;
+    TableEvaluator& operator=(const TableEvaluator& other) = default;
+    TableEvaluator& operator=(TableEvaluator&& other) noexcept = default;
+
+    virtual double evaluate(const Board& board) const override;
+    double evaluate(PackedBoard board) const;
+    // The line scores do not depend on which way a line is read, only the
+    // corner weights favor one corner.
+    virtual bool is_symmetric() const override {
+        return m_weights.corner == 0.0;
+    }
+
+    // Bounds on every score evaluate() can return.
+    double min_score() const { return m_min_score; }
+    double max_score() const { return m_max_score; }
+
+    const EvaluatorWeights& weights() const { return m_weights; }
+    const CachedTable& cache() const { return m_cache; }
+
+private:
+    double score_line(uint16_t line) const;
+    // Scores the packed cells rows, whose largest exponent is max_exponent.
+    double evaluate_rows(uint64_t rows, int max_exponent) const;
+    static double corner_score(uint64_t rows, int max_exponent);
+    // Identifies the table generated for the weights.
+    uint64_t table_key() const;
+
+    EvaluatorWeights m_weights;
+    CachedTable m_cache;
+    const float* m_line_scores = nullptr;
+    double m_min_score = 0.0;
+    double m_max_score = 0.0;
+};
+
+inline double TableEvaluator::evaluate_rows(
+        uint64_t rows, int max_exponent) const {
+    uint64_t cols = MoveTables::transpose(rows);
+    double score = 0.0;
+    for(int i = 0; i < 4; ++i) {
+        score += m_line_scores[(rows >> (16 * i)) & 0xFFFF];
+        score += m_line_scores[(cols >> (16 * i)) & 0xFFFF];
+    }
+    if(m_weights.corner != 0.0) {
+        score *= 1.0 + m_weights.corner * corner_score(rows, max_exponent);
+    }
+    return score;
+}
+
+inline double TableEvaluator::evaluate(PackedBoard board) const {
+    int max_exponent = 0;
+    if(m_weights.corner != 0.0) {
+        for(int i = 0; i < PackedBoard::TOTAL_BLOCKS; ++i) {
+            max_exponent = std::max(max_exponent, board.get_exponent(i));
+        }
+    }
+    return evaluate_rows(board.bits(), max_exponent);
+}
+
+#endif
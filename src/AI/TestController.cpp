@@ -4,12 +4,16 @@ void TestController::do_turn(Board& board, const GameTime& time) {
     if(board.is_lost()) {
         return;
     }
-    double max_score = 0.0;
+    double max_score = -1.0;
     ShiftDirection max_dir = ShiftDirection::Left;
+    auto successors = board.successors();
     for(int i = 0; i < 4; ++i) {
         auto dir = static_cast<ShiftDirection>(i);
-        Board board_copy = board;
-        board_copy.do_move(dir);
+        if(!successors.is_legal(dir)) {
+            continue;
+        }
+        Board& board_copy = successors.boards[i];
+        board_copy.add_new_block();
         double score = compute_score(board_copy, dir);
         if(score > max_score) {
             max_score = score;
@@ -0,0 +1,75 @@
+#include "TranspositionTable.h"
+
+#include <cstdlib>
+#include <new>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+static constexpr std::size_t HUGE_PAGE_SIZE = std::size_t(2) << 20;
+
+TranspositionTable::TranspositionTable(
+        std::size_t megabytes, ReplacementPolicy policy, bool huge_pages)
+        : m_state(std::make_unique<State>()), m_policy(policy) {
+    std::size_t count = 1;
+    while(2 * count * sizeof(Bucket) <= (megabytes << 20)) {
+        count *= 2;
+    }
+    m_mask = count - 1;
+
+    // Huge pages are only used for whole, aligned pages.
+    std::size_t bytes = count * sizeof(Bucket);
+    std::size_t alignment = alignof(Bucket);
+    if(huge_pages && bytes >= HUGE_PAGE_SIZE) {
+        alignment = HUGE_PAGE_SIZE;
+    }
+    void* memory = std::aligned_alloc(alignment, bytes);
+    if(memory == nullptr) {
+        std::abort();
+    }
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if(alignment == HUGE_PAGE_SIZE) {
+        madvise(memory, bytes, MADV_HUGEPAGE);
+    }
+#endif
+    m_buckets.reset(new(memory) Bucket[count]);
+    clear();
+}
+
+void TranspositionTable::BucketDeleter::operator()(Bucket* buckets) const {
+    // Bucket is trivially destructible, so the memory only has to be freed.
+    std::free(buckets);
+}
+
+void TranspositionTable::new_search() {
+    m_state->generation.fetch_add(1, std::memory_order_relaxed);
+}
+
+void TranspositionTable::clear() {
+    for(std::size_t i = 0; i <= m_mask; ++i) {
+        for(auto& word : m_buckets[i].words) {
+            word.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+TTCounters TranspositionTable::counters() const {
+    TTCounters counters;
+    for(const auto& slot : m_state->slots) {
+        counters.probes += slot.probes.load(std::memory_order_relaxed);
+        counters.hits += slot.hits.load(std::memory_order_relaxed);
+        counters.collisions += slot.collisions.load(std::memory_order_relaxed);
+        counters.overwrites += slot.overwrites.load(std::memory_order_relaxed);
+    }
+    return counters;
+}
+
+void TranspositionTable::reset_counters() {
+    for(auto& slot : m_state->slots) {
+        slot.probes.store(0, std::memory_order_relaxed);
+        slot.hits.store(0, std::memory_order_relaxed);
+        slot.collisions.store(0, std::memory_order_relaxed);
+        slot.overwrites.store(0, std::memory_order_relaxed);
+    }
+}
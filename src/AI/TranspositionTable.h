@@ -0,0 +1,300 @@
+#ifndef TRANSPOSITIONTABLE_H_
+#define TRANSPOSITIONTABLE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+// How a stored score relates to the true score of the position.
+enum class Bound : uint8_t {
+    // The search finished inside its window, so the score is exact.
+    Exact = 0,
+    // The search was cut off above its window, the true score is higher.
+    Lower = 1,
+    // No move reached the window, the true score is lower.
+    Upper = 2,
+};
+
+// Which entry is kept when a bucket is full.
+enum class ReplacementPolicy {
+    // The newest result always wins, evicting the shallowest entry.
+    Always = 0,
+    // Entries of the current search are only replaced by results searched
+    // at least as deep, or by an exact result for the same position.
+    // Entries from earlier searches are always replaced.
+    DepthPreferred = 1,
+};
+
+// A search result, as read from the table.
+struct TTEntry {
+    double score = 0.0;
+    // The remaining depth the score was searched to.
+    int8_t depth = 0;
+    Bound bound = Bound::Exact;
+    // The ShiftDirection that produced the score, or -1 if not known.
+    int8_t best_move = -1;
+};
+
+// Counts of table events since the last reset_counters().
+struct TTCounters {
+    uint64_t probes = 0;
+    uint64_t hits = 0;
+    // Probes that missed while the bucket was full of other positions.
+    uint64_t collisions = 0;
+    // Stores that evicted an entry of another position.
+    uint64_t overwrites = 0;
+};
+
+// A fixed size hash table of search results that any number of threads can
+// probe and store into at once, without locks.
+//
+// The table is an array of 64 byte buckets, one cache line each, holding 4
+// entries of 16 bytes. The bucket is picked by the low bits of the position
+// hash and the upper 40 bits are kept in the entry to tell positions apart.
+// An entry is two words, the score and the rest of the entry XORed with the
+// score. Writers store both words without synchronizing, and readers check
+// the key after undoing the XOR, so an entry torn by two racing writers
+// fails the check and reads as a miss rather than as a wrong result.
+//
+// The key check only covers the upper bits of the check word, so a torn
+// entry whose scores agree in those bits can still pass it. probe() also
+// checks that the move and the bound are in range and treats an entry that
+// is not as a miss.
+//
+// Every entry records the search it was stored in. new_search() starts a
+// new one, which keeps older results readable but makes them the first to
+// be evicted.
+class TranspositionTable {
+public:
+    static constexpr int ENTRIES_PER_BUCKET = 4;
+
+    // Uses the largest power of two number of buckets that fits in
+    // megabytes. If huge_pages is set, the kernel is asked to back the table
+    // with huge pages, which saves most of the TLB misses of random probes.
+    explicit TranspositionTable(std::size_t megabytes = 16,
+            ReplacementPolicy policy = ReplacementPolicy::DepthPreferred,
+            bool huge_pages = false);
+    ~TranspositionTable() = default;
+
+    TranspositionTable(const TranspositionTable& other) = delete;
+    TranspositionTable(TranspositionTable&& other) noexcept = default;
+    TranspositionTable& operator=(const TranspositionTable& other) = delete;
+    TranspositionTable& operator=(
+            TranspositionTable&& other) noexcept = default;
+
+    // Sets entry and returns true if key is stored.
+    bool probe(uint64_t key, TTEntry& entry) const;
+    void store(uint64_t key,
+            int depth,
+            double score,
+            Bound bound,
+            int8_t best_move);
+    // Ages every stored entry by one search.
+    void new_search();
+    // Empties the table. Not safe while other threads use it.
+    void clear();
+
+    TTCounters counters() const;
+    void reset_counters();
+
+    // The number of entries.
+    std::size_t size() const { return (m_mask + 1) * ENTRIES_PER_BUCKET; }
+    std::size_t bytes() const { return (m_mask + 1) * sizeof(Bucket); }
+    ReplacementPolicy policy() const { return m_policy; }
+    uint8_t generation() const;
+
+private:
+    struct alignas(64) Bucket {
+        // The check word then the score word of each entry.
+        std::atomic<uint64_t> words[2 * ENTRIES_PER_BUCKET];
+    };
+    struct BucketDeleter {
+        void operator()(Bucket* buckets) const;
+    };
+    // Threads are spread over this many counter slots.
+    static constexpr int COUNTER_SLOTS = 64;
+    // The counters of the threads that use one slot. Each slot is its own
+    // cache line, so threads counting at once do not contend for it.
+    struct alignas(64) CounterSlot {
+        std::atomic<uint64_t> probes{0};
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> collisions{0};
+        std::atomic<uint64_t> overwrites{0};
+    };
+    // Kept apart from the buckets and behind a pointer, since atomics can
+    // not be moved.
+    struct alignas(64) State {
+        std::atomic<uint8_t> generation{0};
+        CounterSlot slots[COUNTER_SLOTS];
+    };
+
+    // Layout of the check word. The depth is stored plus one, so that 0
+    // marks an empty entry.
+    static constexpr uint64_t TAG_MASK = 0xFFFFFFFFFF000000ULL;
+    static constexpr int GENERATION_SHIFT = 16;
+    static constexpr int DEPTH_SHIFT = 8;
+    static constexpr int BOUND_SHIFT = 4;
+
+    static uint64_t score_bits(double score);
+    static uint64_t pack(uint64_t key,
+            uint8_t generation,
+            int depth,
+            Bound bound,
+            int8_t best_move);
+    static int stored_depth(uint64_t check) {
+        return static_cast<int>((check >> DEPTH_SHIFT) & 0xFF) - 1;
+    }
+    static uint8_t stored_generation(uint64_t check) {
+        return static_cast<uint8_t>(check >> GENERATION_SHIFT);
+    }
+
+    Bucket& bucket(uint64_t key) const {
+        return m_buckets.get()[key & m_mask];
+    }
+    // The counter slot of the calling thread.
+    CounterSlot& counter_slot() const;
+
+    std::unique_ptr<Bucket[], BucketDeleter> m_buckets;
+    std::unique_ptr<State> m_state;
+    // Masks a key to a bucket index.
+    uint64_t m_mask = 0;
+    ReplacementPolicy m_policy;
+};
+
+inline uint64_t TranspositionTable::score_bits(double score) {
+    uint64_t bits;
+    std::memcpy(&bits, &score, sizeof(bits));
+    return bits;
+}
+
+inline uint64_t TranspositionTable::pack(uint64_t key,
+        uint8_t generation,
+        int depth,
+        Bound bound,
+        int8_t best_move) {
+    return (key & TAG_MASK) | uint64_t(generation) << GENERATION_SHIFT |
+           uint64_t(depth + 1) << DEPTH_SHIFT |
+           uint64_t(bound) << BOUND_SHIFT | uint64_t(best_move + 1);
+}
+
+inline uint8_t TranspositionTable::generation() const {
+    return m_state->generation.load(std::memory_order_relaxed);
+}
+
+inline TranspositionTable::CounterSlot&
+TranspositionTable::counter_slot() const {
+    // Threads take slots in the order they first count, so up to
+    // COUNTER_SLOTS threads never share one.
+    static std::atomic<int> next_slot{0};
+    static thread_local int slot =
+            next_slot.fetch_add(1, std::memory_order_relaxed) % COUNTER_SLOTS;
+    return m_state->slots[slot];
+}
+
+inline bool TranspositionTable::probe(uint64_t key, TTEntry& entry) const {
+    auto& words = bucket(key).words;
+    auto& counters = counter_slot();
+    counters.probes.fetch_add(1, std::memory_order_relaxed);
+    bool full = true;
+    for(int i = 0; i < ENTRIES_PER_BUCKET; ++i) {
+        uint64_t score = words[2 * i + 1].load(std::memory_order_relaxed);
+        uint64_t check = words[2 * i].load(std::memory_order_relaxed) ^ score;
+        if(stored_depth(check) < 0) {
+            full = false;
+            continue;
+        }
+        if((check & TAG_MASK) != (key & TAG_MASK)) {
+            continue;
+        }
+        int bound = static_cast<int>((check >> BOUND_SHIFT) & 0xF);
+        int best_move = static_cast<int>(check & 0xF) - 1;
+        if(bound > static_cast<int>(Bound::Upper) || best_move > 3) {
+            // Torn by two racing stores of the same position.
+            continue;
+        }
+        std::memcpy(&entry.score, &score, sizeof(score));
+        entry.depth = static_cast<int8_t>(stored_depth(check));
+        entry.bound = static_cast<Bound>(bound);
+        entry.best_move = static_cast<int8_t>(best_move);
+        counters.hits.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    if(full) {
+        counters.collisions.fetch_add(1, std::memory_order_relaxed);
+    }
+    return false;
+}
+
+inline void TranspositionTable::store(uint64_t key,
+        int depth,
+        double score,
+        Bound bound,
+        int8_t best_move) {
+    auto& words = bucket(key).words;
+    auto current = generation();
+
+    // Use the entry of the same position if there is one, then an empty
+    // one, then the entry that is least worth keeping: the oldest, and of
+    // those the shallowest. The whole bucket is checked for the position
+    // first, since an empty entry can come before it after a race.
+    int match = -1;
+    int empty = -1;
+    int victim = 0;
+    int victim_worth = 0;
+    uint64_t match_check = 0;
+    uint64_t victim_check = 0;
+    for(int i = 0; i < ENTRIES_PER_BUCKET; ++i) {
+        uint64_t check = words[2 * i].load(std::memory_order_relaxed) ^
+                         words[2 * i + 1].load(std::memory_order_relaxed);
+        int stored = stored_depth(check);
+        if(stored < 0) {
+            if(empty < 0) {
+                empty = i;
+            }
+            continue;
+        }
+        if((check & TAG_MASK) == (key & TAG_MASK)) {
+            match = i;
+            match_check = check;
+            break;
+        }
+        uint8_t age = current - stored_generation(check);
+        int worth = stored - 256 * age;
+        if(i == 0 || worth < victim_worth) {
+            victim = i;
+            victim_worth = worth;
+            victim_check = check;
+        }
+    }
+
+    // A deeper result of this search is worth more than a shallower one,
+    // unless the new one is exact.
+    auto keeps = [&](uint64_t old_check) {
+        return m_policy == ReplacementPolicy::DepthPreferred &&
+               stored_generation(old_check) == current &&
+               stored_depth(old_check) > depth;
+    };
+    int slot = match;
+    if(match >= 0) {
+        if(bound != Bound::Exact && keeps(match_check)) {
+            return;
+        }
+    } else if(empty >= 0) {
+        slot = empty;
+    } else {
+        if(keeps(victim_check)) {
+            return;
+        }
+        slot = victim;
+        counter_slot().overwrites.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint64_t bits = score_bits(score);
+    uint64_t check = pack(key, current, depth, bound, best_move);
+    words[2 * slot].store(check ^ bits, std::memory_order_relaxed);
+    words[2 * slot + 1].store(bits, std::memory_order_relaxed);
+}
+
+#endif
@@ -0,0 +1,479 @@
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "AI/ExpectimaxController.h"
+#include "AI/MinimaxController.h"
+#include "AI/TableEvaluator.h"
+#include "Board.h"
+#include "BoardAllocator.h"
+#include "BoardBatch.h"
+#include "MoveTables.h"
+#include "PackedBoard.h"
+#include "SimdBoard.h"
+
+static constexpr int POSITION_COUNT = 4096;
+static constexpr int ROUNDS = 64;
+// The positions searched by the pruning benchmark are taken every
+// SEARCH_POSITION_INTERVAL moves of a game. The reuse benchmark takes
+// consecutive ones.
+static constexpr int SEARCH_POSITION_COUNT = 40;
+static constexpr int SEARCH_POSITION_INTERVAL = 25;
+static constexpr int SEARCH_DEPTH = 4;
+// Minimax is searched to its default depth.
+static constexpr int MINIMAX_SEARCH_DEPTH = 6;
+// The node storage benchmark fills this many boards per simulated search.
+static constexpr int STORAGE_BOARDS = 4096;
+static constexpr int STORAGE_ROUNDS = 256;
+// Chance nodes this many moves from the leaves are split into tasks.
+static constexpr int SEARCH_SPLIT_DEPTH = 2;
+
+struct KernelTiming {
+    std::chrono::duration<double> time{0.0};
+    uint64_t checksum = 0;
+};
+
+static std::vector<PackedBoard> make_positions(uint64_t seed) {
+    std::mt19937_64 rng(seed);
+    std::uniform_int_distribution<int> empty_dist(0, 1);
+    std::uniform_int_distribution<int> exponent_dist(1, 11);
+
+    std::vector<PackedBoard> positions;
+    positions.reserve(POSITION_COUNT);
+    for(int i = 0; i < POSITION_COUNT; ++i) {
+        PackedBoard board;
+        for(int j = 0; j < PackedBoard::TOTAL_BLOCKS; ++j) {
+            if(empty_dist(rng) == 0) {
+                board.set_exponent(j, exponent_dist(rng));
+            }
+        }
+        positions.push_back(board);
+    }
+    return positions;
+}
+
+template <typename T, typename F>
+static KernelTiming time_kernel(const std::vector<T>& positions, F&& shift) {
+    KernelTiming out;
+    auto start = std::chrono::high_resolution_clock::now();
+    for(int round = 0; round < ROUNDS; ++round) {
+        for(const auto& position : positions) {
+            for(int i = 0; i < 4; ++i) {
+                auto dir = static_cast<ShiftDirection>(i);
+                out.checksum += shift(position, dir);
+            }
+        }
+    }
+    out.time = std::chrono::high_resolution_clock::now() - start;
+    return out;
+}
+
+static void print_timing(std::ostream& stream,
+        const char* name,
+        const KernelTiming& timing,
+        const KernelTiming& baseline) {
+    double shifts = static_cast<double>(POSITION_COUNT) * ROUNDS * 4;
+    stream << "\t" << name << ": " << shifts / timing.time.count() / 1e6
+           << " M shifts/s (" << baseline.time.count() / timing.time.count()
+           << "x)";
+    if(timing.checksum != baseline.checksum) {
+        stream << " -- MISMATCH";
+    }
+    stream << std::endl;
+}
+
+// Reports how the lookup tables were loaded at startup, against the time
+// it takes to generate them from scratch.
+static void print_table_startup(std::ostream& stream) {
+    stream << "Lookup tables (cache in '" << CachedTable::cache_directory()
+           << "'):" << std::endl;
+    stream << "\tMove tables: " << MoveTables::cache() << std::endl;
+
+    TableEvaluator evaluator;
+    stream << "\tEvaluator: " << evaluator.cache() << std::endl;
+
+    auto data = std::make_unique<MoveTables::Data>();
+    auto start = std::chrono::high_resolution_clock::now();
+    MoveTables::generate(*data);
+    std::chrono::duration<double> generate_time =
+            std::chrono::high_resolution_clock::now() - start;
+    stream << "\tGenerating the move tables: " << generate_time.count() * 1e3
+           << " ms" << std::endl;
+}
+
+// Positions from a game played by a shallow expectimax search, which are
+// closer to what a search sees than random boards are.
+static std::vector<PackedBoard> make_game_positions(
+        uint64_t seed, int interval = SEARCH_POSITION_INTERVAL) {
+    SearchOptions options;
+    options.depth = 2;
+    ExpectimaxController player(seed, options);
+    Board board(seed);
+    board.add_new_block(0);
+    board.add_new_block(1);
+
+    std::vector<PackedBoard> positions;
+    for(int move = 0; !board.is_lost() && PackedBoard::can_pack(board);
+            ++move) {
+        PackedBoard packed(board);
+        if(move % interval == 0) {
+            positions.push_back(packed);
+            if(positions.size() == SEARCH_POSITION_COUNT) {
+                break;
+            }
+        }
+        ShiftDirection dir;
+        if(!player.best_move(packed, dir)) {
+            break;
+        }
+        board.do_move(dir);
+    }
+    return positions;
+}
+
+// Searches the same positions with each kind of chance node pruning and
+// reports the nodes visited against the unpruned search. Pruning must not
+// change the moves.
+static void print_search_pruning(std::ostream& stream, uint64_t seed) {
+    auto positions = make_game_positions(seed);
+    stream << "Expectimax pruning (" << positions.size()
+           << " positions, depth " << SEARCH_DEPTH << "):" << std::endl;
+
+    const std::pair<const char*, ChancePruning> modes[] = {
+            {"None", ChancePruning::None},
+            {"Star1", ChancePruning::Star1},
+            {"Star2", ChancePruning::Star2},
+    };
+    std::vector<ShiftDirection> baseline_moves;
+    int64_t baseline_nodes = 0;
+    for(const auto& [name, pruning] : modes) {
+        SearchOptions options;
+        options.depth = SEARCH_DEPTH;
+        options.chance_pruning = pruning;
+        ExpectimaxController controller(seed, options);
+
+        ExpectimaxStats total;
+        std::vector<ShiftDirection> moves;
+        auto start = std::chrono::high_resolution_clock::now();
+        for(const auto& position : positions) {
+            ShiftDirection dir = ShiftDirection::Left;
+            controller.best_move(position, dir);
+            moves.push_back(dir);
+            const auto& stats = controller.stats();
+            total.move_nodes += stats.move_nodes;
+            total.chance_nodes += stats.chance_nodes;
+            total.chance_cutoffs += stats.chance_cutoffs;
+            total.probe_cutoffs += stats.probe_cutoffs;
+        }
+        std::chrono::duration<double> time =
+                std::chrono::high_resolution_clock::now() - start;
+
+        int64_t nodes = total.move_nodes + total.chance_nodes;
+        if(pruning == ChancePruning::None) {
+            baseline_moves = moves;
+            baseline_nodes = nodes;
+        }
+        stream << "\t" << name << ": " << nodes << " nodes ("
+               << 100.0 * nodes / baseline_nodes << "%), "
+               << total.chance_cutoffs << " cutoffs, " << total.probe_cutoffs
+               << " probe cutoffs, " << time.count() * 1e3 << " ms";
+        if(moves != baseline_moves) {
+            stream << " -- MISMATCH";
+        }
+        stream << std::endl;
+    }
+}
+
+// Times the same searches on 1, 2, 4, ... threads, up to the hardware
+// threads or at least the 4 moves, with only the root moves split and with
+// work stealing below the root.
+static void print_search_scaling(std::ostream& stream, uint64_t seed) {
+    auto positions = make_game_positions(seed);
+    int max_threads = std::max(4u, std::thread::hardware_concurrency());
+    stream << "Expectimax threads (" << positions.size() << " positions, depth "
+           << SEARCH_DEPTH << ", " << std::thread::hardware_concurrency()
+           << " hardware threads):" << std::endl;
+
+    const std::pair<const char*, int> modes[] = {
+            {"Root split", 0},
+            {"Work stealing", SEARCH_SPLIT_DEPTH},
+    };
+    std::chrono::duration<double> baseline{0.0};
+    std::vector<ShiftDirection> baseline_moves;
+    for(const auto& [name, split_depth] : modes) {
+        for(int threads = 1; threads <= max_threads; threads *= 2) {
+            SearchOptions options;
+            options.depth = SEARCH_DEPTH;
+            options.threads = threads;
+            options.split_depth = split_depth;
+            ExpectimaxController controller(seed, options);
+
+            std::vector<ShiftDirection> moves;
+            WorkStealingStats totals;
+            auto start = std::chrono::high_resolution_clock::now();
+            for(const auto& position : positions) {
+                ShiftDirection dir = ShiftDirection::Left;
+                controller.best_move(position, dir);
+                moves.push_back(dir);
+                if(const auto* scheduler = controller.scheduler()) {
+                    auto stats = scheduler->stats();
+                    totals.tasks += stats.tasks;
+                    totals.steals += stats.steals;
+                    totals.idle += stats.idle;
+                }
+            }
+            std::chrono::duration<double> time =
+                    std::chrono::high_resolution_clock::now() - start;
+            if(baseline_moves.empty()) {
+                baseline = time;
+                baseline_moves = moves;
+            }
+            stream << "\t" << name << ", " << threads
+                   << " threads: " << time.count() * 1e3 << " ms ("
+                   << baseline.count() / time.count() << "x)";
+            if(controller.scheduler()) {
+                stream << ", " << totals.tasks << " tasks, " << totals.steals
+                       << " steals, " << totals.idle.count() * 1e3
+                       << " ms idle";
+            }
+            if(moves != baseline_moves) {
+                stream << " -- MISMATCH";
+            }
+            stream << std::endl;
+        }
+    }
+}
+
+// Searches the same positions with Minimax with and without move ordering,
+// and reports how much of the tree alpha-beta cut off.
+static void print_minimax_ordering(std::ostream& stream, uint64_t seed) {
+    auto positions = make_game_positions(seed);
+    stream << "Minimax move ordering (" << positions.size()
+           << " positions, depth " << MINIMAX_SEARCH_DEPTH << "):" << std::endl;
+
+    Board board(seed);
+    std::vector<ShiftDirection> baseline_moves;
+    for(bool ordering : {false, true}) {
+        SearchOptions options;
+        options.depth = MINIMAX_SEARCH_DEPTH;
+        options.move_ordering = ordering;
+        MinimaxController controller(seed, options);
+
+        MinimaxStats total;
+        std::vector<ShiftDirection> moves;
+        auto start = std::chrono::high_resolution_clock::now();
+        for(const auto& position : positions) {
+            position.unpack(board);
+            moves.push_back(controller.best_move(board));
+            const auto& stats = controller.stats();
+            total.nodes_evaluated += stats.nodes_evaluated;
+            total.nodes_pruned += stats.nodes_pruned;
+            total.table_hits += stats.table_hits;
+        }
+        std::chrono::duration<double> time =
+                std::chrono::high_resolution_clock::now() - start;
+        if(!ordering) {
+            baseline_moves = moves;
+        }
+
+        double prune_ratio = static_cast<double>(total.nodes_pruned) /
+                             (total.nodes_pruned + total.nodes_evaluated);
+        stream << "\t" << (ordering ? "Ordered" : "Unordered") << ": "
+               << total.nodes_evaluated << " nodes, " << total.nodes_pruned
+               << " cutoffs (" << 100.0 * prune_ratio << "% prune ratio), "
+               << total.table_hits << " table hits, " << time.count() * 1e3
+               << " ms";
+        if(moves != baseline_moves) {
+            stream << " -- MISMATCH";
+        }
+        stream << std::endl;
+    }
+}
+
+// Searches consecutive positions of a game with one controller, keeping the
+// transposition table between moves or clearing it before each.
+static void print_search_reuse(std::ostream& stream, uint64_t seed) {
+    auto positions = make_game_positions(seed, 1);
+    stream << "Minimax table reuse (" << positions.size()
+           << " consecutive positions, depth " << SEARCH_DEPTH
+           << "):" << std::endl;
+
+    Board board(seed);
+    std::vector<ShiftDirection> baseline_moves;
+    for(bool keep_table : {false, true}) {
+        SearchOptions options;
+        options.depth = SEARCH_DEPTH;
+        options.keep_table = keep_table;
+        MinimaxController controller(seed, options);
+
+        MinimaxStats total;
+        std::vector<ShiftDirection> moves;
+        auto start = std::chrono::high_resolution_clock::now();
+        for(const auto& position : positions) {
+            position.unpack(board);
+            moves.push_back(controller.best_move(board));
+            total.nodes_evaluated += controller.stats().nodes_evaluated;
+            total.table_hits += controller.stats().table_hits;
+        }
+        std::chrono::duration<double> time =
+                std::chrono::high_resolution_clock::now() - start;
+        if(!keep_table) {
+            baseline_moves = moves;
+        }
+
+        // Entries from the last move can answer a shallower iteration
+        // with a deeper result, so a few moves may differ. This only shows
+        // how close the searches are: whether a kept table plays as well
+        // is a question for whole games, where a different move changes
+        // every later position.
+        int same = 0;
+        for(std::size_t i = 0; i < moves.size(); ++i) {
+            same += moves[i] == baseline_moves[i] ? 1 : 0;
+        }
+        stream << "\t" << (keep_table ? "Kept" : "Cleared") << ": "
+               << total.nodes_evaluated << " nodes, " << total.table_hits
+               << " table hits, " << time.count() * 1e3 / positions.size()
+               << " ms per move, " << same << " moves the same" << std::endl;
+    }
+}
+
+// Stores boards the way a tree search would per move, in a std::vector
+// freed at the end of the move and in a BoardVector whose allocator is
+// reset instead.
+static void print_board_storage(std::ostream& stream, uint64_t seed) {
+    Board board(seed);
+    board.add_new_block(0);
+    board.add_new_block(1);
+
+    std::size_t checksum = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for(int round = 0; round < STORAGE_ROUNDS; ++round) {
+        std::vector<Board> boards;
+        for(int i = 0; i < STORAGE_BOARDS; ++i) {
+            boards.push_back(board);
+        }
+        checksum += boards.size();
+    }
+    std::chrono::duration<double> vector_time =
+            std::chrono::high_resolution_clock::now() - start;
+
+    BoardAllocator allocator;
+    start = std::chrono::high_resolution_clock::now();
+    for(int round = 0; round < STORAGE_ROUNDS; ++round) {
+        BoardVector boards(allocator);
+        for(int i = 0; i < STORAGE_BOARDS; ++i) {
+            boards.push_back(board);
+        }
+        checksum += boards.size();
+        allocator.reset();
+    }
+    std::chrono::duration<double> arena_time =
+            std::chrono::high_resolution_clock::now() - start;
+
+    stream << "Node storage (" << STORAGE_BOARDS << " boards, "
+           << STORAGE_ROUNDS << " rounds, checksum " << checksum
+           << "):" << std::endl;
+    stream << "\tstd::vector: " << vector_time.count() * 1e3 << " ms"
+           << std::endl;
+    stream << "\tBoardVector: " << arena_time.count() * 1e3 << " ms ("
+           << vector_time / arena_time << "x), "
+           << allocator.bytes_reserved() << " bytes reserved" << std::endl;
+}
+
+void run_benchmarks(std::ostream& stream, uint64_t seed) {
+    print_table_startup(stream);
+    print_search_pruning(stream, seed);
+    print_minimax_ordering(stream, seed);
+    print_search_reuse(stream, seed);
+    print_board_storage(stream, seed);
+    print_search_scaling(stream, seed);
+
+    auto packed_positions = make_positions(seed);
+
+    Board board_template(seed);
+    std::vector<Board> board_positions;
+    board_positions.reserve(packed_positions.size());
+    for(const auto& packed : packed_positions) {
+        packed.unpack(board_template);
+        board_positions.push_back(board_template);
+    }
+
+    // The checksum counts the moves that changed the board, which must
+    // agree between all kernels.
+    auto board_timing = time_kernel(
+            board_positions, [](const Board& position, ShiftDirection dir) {
+                Board board = position;
+                return board.shift_board(dir) ? 1 : 0;
+            });
+    auto table_timing = time_kernel(packed_positions,
+            [](const PackedBoard& position, ShiftDirection dir) {
+                PackedBoard board = position;
+                return board.shift(dir) ? 1 : 0;
+            });
+
+    BoardBatch batch;
+    batch.reserve(packed_positions.size());
+    for(const auto& packed : packed_positions) {
+        batch.push_back(packed);
+    }
+    KernelTiming batch_timing;
+    {
+        // apply() moves the boards in place, so every direction works on a
+        // fresh copy. The copies reuse the storage of the last round and
+        // are made outside of the timed part, like the copies the other
+        // kernels make of a single board.
+        BatchMoveResult result;
+        std::array<BoardBatch, 4> work;
+        for(int round = 0; round < ROUNDS; ++round) {
+            for(auto& copy : work) {
+                copy = batch;
+            }
+            auto start = std::chrono::high_resolution_clock::now();
+            for(int i = 0; i < 4; ++i) {
+                work[i].apply(static_cast<ShiftDirection>(i), result);
+                for(auto changed : result.changed) {
+                    batch_timing.checksum += changed;
+                }
+            }
+            batch_timing.time +=
+                    std::chrono::high_resolution_clock::now() - start;
+        }
+    }
+
+    stream << "Move kernels (" << POSITION_COUNT << " positions, " << ROUNDS
+           << " rounds):" << std::endl;
+    print_timing(stream, "Board::shift_board", board_timing, board_timing);
+    print_timing(stream, "PackedBoard tables", table_timing, board_timing);
+    print_timing(stream, "BoardBatch", batch_timing, board_timing);
+
+#ifdef SIMD_BOARD_AVAILABLE
+    if(!SimdBoard::is_supported()) {
+        stream << "\tSimdBoard: not supported by this CPU" << std::endl;
+        return;
+    }
+    std::vector<SimdBoard> simd_positions;
+    simd_positions.reserve(packed_positions.size());
+    for(const auto& packed : packed_positions) {
+        simd_positions.push_back(SimdBoard::from_packed(packed.bits()));
+    }
+    auto simd_timing = time_kernel(simd_positions,
+            [](const SimdBoard& position, ShiftDirection dir) {
+                SimdBoard board = position;
+                return board.shift(dir) ? 1 : 0;
+            });
+    auto packed_simd_timing = time_kernel(packed_positions,
+            [](const PackedBoard& position, ShiftDirection dir) {
+                PackedBoard board = position;
+                return board.shift(dir, MoveKernel::Simd) ? 1 : 0;
+            });
+    print_timing(stream, "SimdBoard", simd_timing, board_timing);
+    print_timing(
+            stream, "PackedBoard through SIMD", packed_simd_timing, board_timing);
+#endif
+}
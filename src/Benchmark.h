@@ -0,0 +1,11 @@
+#ifndef BENCHMARK_H_
+#define BENCHMARK_H_
+
+#include <cstdint>
+#include <ostream>
+
+// Times the board kernels on a fixed set of random positions and writes
+// the results to stream.
+void run_benchmarks(std::ostream& stream, uint64_t seed);
+
+#endif
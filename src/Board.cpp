@@ -3,39 +3,33 @@
 #include <cmath>
 #include <iostream>
 
+#include "PackedBoard.h"
+
 std::ostream& operator<<(std::ostream& stream, sf::Vector2<int> v) {
     stream << "(" << v.x << "," << v.y << ")";
     return stream;
 }
 
-Board::Board(int width, int height, uint64_t seed)
-    : m_width(width), m_height(height) {
-    // m_cells.resize(width * height);
-    std::seed_seq s = {seed >> 32, seed & 0xFFFFFFFF};
-    m_rng.seed(s);
-
-    for(int i = 0; i < 20; ++i) {
-        std::cout << (2 << i) << " " << score_for_cell(Cell(2 << i))
-                  << std::endl;
-    }
-}
+template <int W, int H>
+BasicBoard<W, H>::BasicBoard(uint64_t seed) : m_seed(seed) {}
 // Mpstly works, but is over 1 OOM slower than the new methods.
-void Board::shift_board_legacy(ShiftDirection dir) {
+template <int W, int H>
+void BasicBoard<W, H>::shift_board_legacy(ShiftDirection dir) {
     auto shift = dir_offset(dir);
     bool changed = false;
     int idx = 1;
     do {
         changed = false;
-        for(int y = 0; y < m_height; ++y) {
-            for(int x = 0; x < m_width; ++x) {
+        for(int y = 0; y < H; ++y) {
+            for(int x = 0; x < W; ++x) {
                 auto pos = sf::Vector2<int>(x, y);
                 auto shift_pos = pos + shift;
-                if(shift_pos.x < 0 || shift_pos.x >= m_width ||
-                        shift_pos.y < 0 || shift_pos.y >= m_height) {
+                if(shift_pos.x < 0 || shift_pos.x >= W || shift_pos.y < 0 ||
+                        shift_pos.y >= H) {
                     continue;
                 }
-                auto& shift_cell = get_cell(shift_pos.x, shift_pos.y);
-                auto& cur_cell = get_cell(pos.x, pos.y);
+                auto& shift_cell = m_cells[shift_pos.x + shift_pos.y * W];
+                auto& cur_cell = m_cells[pos.x + pos.y * W];
                 if(cur_cell.value != Cell::EMPTY) {
                     changed = changed || merge(shift_cell, cur_cell);
                 }
@@ -43,9 +37,11 @@ void Board::shift_board_legacy(ShiftDirection dir) {
         }
         idx += 1;
     } while(changed == true);
+    recompute_aggregates();
 }
 
-sf::Vector2<int> Board::dir_offset(ShiftDirection dir) {
+template <int W, int H>
+sf::Vector2<int> BasicBoard<W, H>::dir_offset(ShiftDirection dir) {
     switch(dir) {
     case ShiftDirection::Up:
         return sf::Vector2<int>(0, -1);
@@ -60,7 +56,8 @@ sf::Vector2<int> Board::dir_offset(ShiftDirection dir) {
     }
 }
 
-bool Board::merge(Cell& cell1, Cell& cell2) {
+template <int W, int H>
+bool BasicBoard<W, H>::merge(Cell& cell1, Cell& cell2) {
     if(cell1.value == Cell::EMPTY) {
         std::swap(cell1, cell2);
         return true;
@@ -72,9 +69,10 @@ bool Board::merge(Cell& cell1, Cell& cell2) {
     return false;
 }
 
-int Board::get_new_cell_val() {
-    int two_or_four = m_rng() % 10;
-    if(two_or_four == 9) {
+template <int W, int H>
+int BasicBoard<W, H>::get_new_cell_val(SpawnRng& rng) {
+    int two_or_four = rng.uniform(SPAWN_FOUR_ONE_IN);
+    if(two_or_four == SPAWN_FOUR_ONE_IN - 1) {
         return 4;
     } else {
         return 2;
@@ -82,41 +80,191 @@ int Board::get_new_cell_val() {
 }
 
 
-void Board::add_new_block() {
+template <int W, int H>
+void BasicBoard<W, H>::add_new_block(int spawn) {
     int free = free_spaces();
     if(free == 0) {
         m_is_lost = true;
         return;
     }
 
-    int selector = m_rng() % free;
-    int val = get_new_cell_val();
+    // Without the spawn number, tiles spawned in the same turn would draw
+    // the same value.
+    SpawnRng rng(m_seed, m_turn | uint64_t(spawn) << 32);
+    int selector = rng.uniform(free);
+    int val = get_new_cell_val(rng);
+    set_cell(nth_free_cell(selector), Cell(val));
+}
 
-    int free_cnt = 0;
-    for(std::size_t i = 0; i < m_cells.size(); ++i) {
-        if(m_cells[i].value == Cell::EMPTY) {
-            if(free_cnt == selector) {
-                m_cells[i].value = val;
-                return;
-            }
-            free_cnt += 1;
+template <int W, int H>
+void BasicBoard<W, H>::set_cell(int idx, Cell cell) {
+    auto old_value = m_cells[idx].value;
+    auto bit = uint64_t(1) << idx;
+    m_hash ^= zobrist_key(idx, old_value) ^ zobrist_key(idx, cell.value);
+    m_packed ^= packed_key(idx, old_value) ^ packed_key(idx, cell.value);
+    if(old_value != Cell::EMPTY) {
+        m_score -= score_for_cell(m_cells[idx]);
+        m_total_value -= old_value;
+    }
+    if(cell.value != Cell::EMPTY) {
+        m_score += score_for_cell(cell);
+        m_total_value += cell.value;
+        m_free_mask &= ~bit;
+    } else {
+        m_free_mask |= bit;
+    }
+    m_cells[idx] = cell;
+
+    if(cell.value >= m_max_value) {
+        m_max_value = cell.value;
+    } else if(old_value == m_max_value) {
+        // The largest tile may have been removed.
+        m_max_value = 0;
+        for(const auto& c : m_cells) {
+            m_max_value = std::max(m_max_value, c.value);
+        }
+    }
+}
+
+template <int W, int H>
+void BasicBoard<W, H>::recompute_aggregates() {
+    m_score = 0.0;
+    m_total_value = 0.0;
+    m_max_value = 0;
+    m_free_mask = 0;
+    m_hash = 0;
+    m_packed = 0;
+    for(int i = 0; i < total_blocks(); ++i) {
+        const auto& cell = m_cells[i];
+        if(cell.value == Cell::EMPTY) {
+            m_free_mask |= uint64_t(1) << i;
+            continue;
+        }
+        m_hash ^= zobrist_key(i, cell.value);
+        m_packed ^= packed_key(i, cell.value);
+        m_score += score_for_cell(cell);
+        m_total_value += cell.value;
+        m_max_value = std::max(m_max_value, cell.value);
+    }
+}
+
+template <int W, int H>
+void BasicBoard<W, H>::apply_packed(uint64_t bits) {
+    uint64_t changed = m_packed ^ bits;
+    while(changed != 0) {
+        int idx = __builtin_ctzll(changed) / 4;
+        changed &= ~(uint64_t(0xF) << (4 * idx));
+        int exponent = (bits >> (4 * idx)) & 0xF;
+        Cell cell(exponent == 0 ? Cell::EMPTY : uint32_t(1) << exponent);
+        auto old_value = m_cells[idx].value;
+        auto bit = uint64_t(1) << idx;
+        m_hash ^= zobrist_key(idx, old_value) ^ zobrist_key(idx, cell.value);
+        if(old_value != Cell::EMPTY) {
+            m_score -= score_for_cell(m_cells[idx]);
+            m_total_value -= old_value;
+        }
+        if(cell.value != Cell::EMPTY) {
+            m_score += score_for_cell(cell);
+            m_total_value += cell.value;
+            m_free_mask &= ~bit;
+        } else {
+            m_free_mask |= bit;
         }
+        m_max_value = std::max(m_max_value, cell.value);
+        m_cells[idx] = cell;
     }
+    m_packed = bits;
 }
 
-bool Board::do_move(ShiftDirection dir) {
+template <int W, int H>
+MoveResult BasicBoard<W, H>::do_move(ShiftDirection dir) {
     if(m_is_lost) {
-        return true;
+        MoveResult lost;
+        lost.moved = true;
+        return lost;
     }
     auto ret = shift_board(dir);
     if(ret) {
         add_new_block();
     } else {
-        m_is_lost = is_filled();
+        m_is_lost = legal_moves() == 0;
     }
     return ret;
 }
 
+template <int W, int H>
+uint8_t BasicBoard<W, H>::legal_moves() const {
+    // A pair of neighbors allows a move towards the empty one of them, or
+    // both ways along the line if they can merge.
+    auto check_pair = [](uint32_t front, uint32_t back, uint8_t towards_front,
+                              uint8_t towards_back) -> uint8_t {
+        if(front == Cell::EMPTY) {
+            return back == Cell::EMPTY ? 0 : towards_front;
+        } else if(back == Cell::EMPTY) {
+            return towards_back;
+        } else if(front == back) {
+            return towards_front | towards_back;
+        }
+        return 0;
+    };
+
+    auto left = move_bit(ShiftDirection::Left);
+    auto right = move_bit(ShiftDirection::Right);
+    auto up = move_bit(ShiftDirection::Up);
+    auto down = move_bit(ShiftDirection::Down);
+
+    uint8_t mask = 0;
+    for(int y = 0; y < H; ++y) {
+        for(int x = 0; x < W - 1; ++x) {
+            mask |= check_pair(m_cells[x + y * W].value,
+                    m_cells[x + 1 + y * W].value,
+                    left,
+                    right);
+        }
+    }
+    for(int y = 0; y < H - 1; ++y) {
+        for(int x = 0; x < W; ++x) {
+            mask |= check_pair(m_cells[x + y * W].value,
+                    m_cells[x + (y + 1) * W].value,
+                    up,
+                    down);
+        }
+    }
+    return mask;
+}
+
+template <int W, int H>
+Successors<BasicBoard<W, H>> BasicBoard<W, H>::successors() const {
+    Successors<BasicBoard> out;
+    if constexpr(W == 4 && H == 4) {
+        // All four moves from the packed cells, with one transpose for the
+        // columns. The move tables never merge two 32768s, so larger boards
+        // take the generic path.
+        if(m_max_value < PackedBoard::MAX_VALUE) {
+            auto packed = PackedBoard(m_packed).successors();
+            out.legal_mask = packed.legal_mask;
+            for(int i = 0; i < 4; ++i) {
+                out.boards[i] = *this;
+                if(out.is_legal(static_cast<ShiftDirection>(i))) {
+                    out.boards[i].apply_packed(packed.boards[i].bits());
+                    out.boards[i].m_turn += 1;
+                    out.rewards[i] = packed.rewards[i];
+                }
+            }
+            return out;
+        }
+    }
+    out.legal_mask = legal_moves();
+    for(int i = 0; i < 4; ++i) {
+        auto dir = static_cast<ShiftDirection>(i);
+        out.boards[i] = *this;
+        if(out.is_legal(dir)) {
+            out.rewards[i] = out.boards[i].shift_board(dir).reward;
+        }
+    }
+    return out;
+}
+
 std::ostream& operator<<(std::ostream& stream, ShiftDirection dir) {
     switch(dir) {
     case ShiftDirection::Down:
@@ -135,233 +283,129 @@ std::ostream& operator<<(std::ostream& stream, ShiftDirection dir) {
     return stream;
 }
 
-bool Board::shift_board(ShiftDirection dir) {
-    bool is_modified = false;
+template <int W, int H>
+MoveResult BasicBoard<W, H>::shift_board(ShiftDirection dir) {
+    MoveResult result;
     switch(dir) {
     case ShiftDirection::Left:
-        is_modified = shift_board_left();
+        shift_board_left(result);
         break;
     case ShiftDirection::Right:
-        is_modified = shift_board_right();
+        shift_board_right(result);
         break;
     case ShiftDirection::Up:
-        is_modified = shift_board_up();
+        shift_board_up(result);
         break;
     case ShiftDirection::Down:
-        is_modified = shift_board_down();
+        shift_board_down(result);
         break;
     }
-    if(is_modified) {
+    if(result.moved) {
         m_turn += 1;
     }
-    return is_modified;
+    return result;
 }
 
 // These functions are written to be fast, as opposed to clean.
-// Using separate functions instead of ifs and generic logic improves
-// execution time significantly, and for many search AIs, these
-// are the most time consuming functions in the program.
-
-bool Board::shift_board_left() {
-    bool is_modified = false;
-    // Iterate the board until finding an empty space
-    for(int y = 0; y < m_height; ++y) {
-        auto y_idx = y * m_width;
-        for(int x = 0; x < m_width; ++x) {
-            auto* cell = &m_cells[x + y_idx];
-            if(cell->value == Cell::EMPTY) {
-                // We found an empty space, now look forward for a non-empty
-                // space.
-                for(int x2 = x + 1; x2 < m_width; ++x2) {
-                    auto& cell2 = m_cells[x2 + y_idx];
-                    if(cell2.value != Cell::EMPTY) {
-                        is_modified = true;
-                        // We found a non-empty space.
-                        // Swap the empty space and non-empty space.
-                        std::swap(*cell, cell2);
-                        // If we are not at the edge, try to merge
-                        if(x != 0) {
-                            Cell* back_cell = &m_cells[x - 1 + y_idx];
-                            if(try_merge(*back_cell, *cell)) {
-                                // We merged, so there is a new open space.
-                                x -= 1;
-                            }
-                        }
-                        // Update to look at the next cell.
-                        x += 1;
-                        cell = &m_cells[x + y_idx];
-                    }
-                }
-                break;
-            } else {
-                // Try to merge blocks next to each other that didn't move.
-                if(x != 0) {
-                    auto& back_cell = m_cells[x - 1 + y_idx];
-                    auto& front_cell = m_cells[x + y_idx];
-                    if(try_merge(back_cell, front_cell)) {
-                        is_modified = true;
-                        x -= 1;
-                    }
-                }
+// Every direction gets its own instantiation of shift_line, with the line
+// length and the distance between cells known at compile time, so that the
+// compiler can fully unroll them. For many search AIs, these are the most
+// time consuming functions in the program.
+
+template <int W, int H>
+template <int Count, int Stride>
+void BasicBoard<W, H>::shift_line(int first, MoveResult& result) {
+    // The next cell to fill, and whether the tile before it may still merge.
+    int target = 0;
+    bool can_merge = false;
+    for(int i = 0; i < Count; ++i) {
+        auto idx = first + i * Stride;
+        auto target_idx = first + target * Stride;
+        if(m_cells[idx].value == Cell::EMPTY) {
+            continue;
+        }
+        if(can_merge &&
+                m_cells[target_idx - Stride].value == m_cells[idx].value) {
+            result.add_merge(merge_cells(target_idx - Stride, idx));
+            // A merged tile can not be merged again in the same move.
+            can_merge = false;
+            result.moved = true;
+        } else {
+            if(target != i) {
+                move_cell(idx, target_idx);
+                result.moved = true;
             }
+            target += 1;
+            can_merge = true;
         }
     }
-    return is_modified;
 }
 
-bool Board::shift_board_right() {
-    bool is_modified = false;
-    // Iterate the board until finding an empty space
-    for(int y = 0; y < m_height; ++y) {
-        auto y_idx = y * m_width;
-        for(int x = m_width - 1; x >= 0; --x) {
-            auto* cell = &m_cells[x + y_idx];
-            if(cell->value == Cell::EMPTY) {
-                // We found an empty space, now look forward for a non-empty
-                // space.
-                for(int x2 = x - 1; x2 >= 0; --x2) {
-                    auto& cell2 = m_cells[x2 + y_idx];
-                    if(cell2.value != Cell::EMPTY) {
-                        is_modified = true;
-                        // We found a non-empty space.
-                        // Swap the empty space and non-empty space.
-                        std::swap(*cell, cell2);
-                        // If we are not at the edge, try to merge
-                        if(x != m_width - 1) {
-                            Cell* back_cell = &m_cells[x + 1 + y_idx];
-                            if(try_merge(*back_cell, *cell)) {
-                                // We merged, so there is a new open space.
-                                x += 1;
-                            }
-                        }
-                        // Update to look at the next cell.
-                        x -= 1;
-                        cell = &m_cells[x + y_idx];
-                    }
-                }
-                break;
-            } else {
-                // Try to merge blocks next to each other that didn't move.
-                if(x != m_width - 1) {
-                    auto& back_cell = m_cells[x + 1 + y_idx];
-                    auto& front_cell = m_cells[x + y_idx];
-                    if(try_merge(back_cell, front_cell)) {
-                        is_modified = true;
-                        x += 1;
-                    }
-                }
-            }
-        }
+// Moves a tile into an empty cell.
+template <int W, int H>
+inline void BasicBoard<W, H>::move_cell(int from, int to) {
+    auto value = m_cells[from].value;
+    m_cells[to] = m_cells[from];
+    m_cells[from].value = Cell::EMPTY;
+    m_free_mask ^= (uint64_t(1) << from) | (uint64_t(1) << to);
+    m_hash ^= zobrist_key(from, value) ^ zobrist_key(to, value);
+    m_packed ^= packed_key(from, value) ^ packed_key(to, value);
+}
+
+// Merges the tile in from into the equal tile in into, and returns the
+// value of the new tile.
+template <int W, int H>
+inline uint32_t BasicBoard<W, H>::merge_cells(int into, int from) {
+    auto old_value = m_cells[into].value;
+    auto value = old_value * 2;
+    m_cells[into].value = value;
+    m_cells[from].value = Cell::EMPTY;
+    m_free_mask |= uint64_t(1) << from;
+    m_hash ^= zobrist_key(into, old_value) ^ zobrist_key(into, value) ^
+              zobrist_key(from, old_value);
+    m_packed ^= packed_key(into, old_value) ^ packed_key(into, value) ^
+                packed_key(from, old_value);
+    // Two tiles of value v/2 score 2 * (v/2) * (log2(v) - 2), a tile of
+    // value v scores v * (log2(v) - 1), so every merge adds exactly v.
+    m_score += value;
+    m_max_value = std::max(m_max_value, value);
+    return value;
+}
+
+template <int W, int H>
+void BasicBoard<W, H>::shift_board_left(MoveResult& result) {
+    for(int y = 0; y < H; ++y) {
+        shift_line<W, 1>(y * W, result);
     }
-    return is_modified;
 }
 
-bool Board::shift_board_up() {
-    bool is_modified = false;
-    // Iterate the board until finding an empty space
-    for(int x = 0; x < m_width; ++x) {
-        for(int y = 0; y < m_height; ++y) {
-            auto* cell = &m_cells[x + y * m_width];
-            if(cell->value == Cell::EMPTY) {
-                // We found an empty space, now look forward for a non-empty
-                // space.
-                for(int y2 = y + 1; y2 < m_height; ++y2) {
-                    auto& cell2 = m_cells[x + y2 * m_width];
-                    if(cell2.value != Cell::EMPTY) {
-                        is_modified = true;
-                        // We found a non-empty space.
-                        // Swap the empty space and non-empty space.
-                        std::swap(*cell, cell2);
-                        // If we are not at the edge, try to merge
-                        if(y != 0) {
-                            Cell* back_cell = &m_cells[x + (y - 1) * m_width];
-                            if(try_merge(*back_cell, *cell)) {
-                                // We merged, so there is a new open space.
-                                y -= 1;
-                            }
-                        }
-                        // Update to look at the next cell.
-                        y += 1;
-                        cell = &m_cells[x + y * m_width];
-                    }
-                }
-                break;
-            } else {
-                // Try to merge blocks next to each other that didn't move.
-                if(y != 0) {
-                    auto& back_cell = m_cells[x + (y - 1) * m_width];
-                    auto& front_cell = m_cells[x + y * m_width];
-                    if(try_merge(back_cell, front_cell)) {
-                        is_modified = true;
-                        y -= 1;
-                    }
-                }
-            }
-        }
+template <int W, int H>
+void BasicBoard<W, H>::shift_board_right(MoveResult& result) {
+    for(int y = 0; y < H; ++y) {
+        shift_line<W, -1>(y * W + W - 1, result);
     }
-    return is_modified;
 }
 
-bool Board::shift_board_down() {
-    bool is_modified = false;
-    // Iterate the board until finding an empty space
-    for(int x = 0; x < m_width; ++x) {
-        for(int y = m_height - 1; y >= 0; --y) {
-            auto* cell = &m_cells[x + y * m_width];
-            if(cell->value == Cell::EMPTY) {
-                // We found an empty space, now look forward for a non-empty
-                // space.
-                for(int y2 = y - 1; y2 >= 0; --y2) {
-                    auto& cell2 = m_cells[x + y2 * m_width];
-                    if(cell2.value != Cell::EMPTY) {
-                        is_modified = true;
-                        // We found a non-empty space.
-                        // Swap the empty space and non-empty space.
-                        std::swap(*cell, cell2);
-                        // If we are not at the edge, try to merge
-                        if(y != m_height - 1) {
-                            Cell* back_cell = &m_cells[x + (y + 1) * m_width];
-                            if(try_merge(*back_cell, *cell)) {
-                                // We merged, so there is a new open space.
-                                y += 1;
-                            }
-                        }
-                        // Update to look at the next cell.
-                        y -= 1;
-                        cell = &m_cells[x + y * m_width];
-                    }
-                }
-                break;
-            } else {
-                // Try to merge blocks next to each other that didn't move.
-                if(y != m_height - 1) {
-                    auto& back_cell = m_cells[x + (y + 1) * m_width];
-                    auto& front_cell = m_cells[x + y * m_width];
-                    if(try_merge(back_cell, front_cell)) {
-                        is_modified = true;
-                        y += 1;
-                    }
-                }
-            }
-        }
+template <int W, int H>
+void BasicBoard<W, H>::shift_board_up(MoveResult& result) {
+    for(int x = 0; x < W; ++x) {
+        shift_line<H, W>(x, result);
     }
-    return is_modified;
 }
 
-bool Board::try_merge(Cell& lhs, Cell& rhs) {
-    if(lhs.value == rhs.value) {
-        lhs.value *= 2;
-        rhs.value = Cell::EMPTY;
-        return true;
+template <int W, int H>
+void BasicBoard<W, H>::shift_board_down(MoveResult& result) {
+    for(int x = 0; x < W; ++x) {
+        shift_line<H, -W>(x + (H - 1) * W, result);
     }
-    return false;
 }
 
-double Board::monotonic_score() const {
+template <int W, int H>
+double BasicBoard<W, H>::monotonic_score() const {
     double score = 0.0;
-    for(int y = 0; y < m_height; ++y) {
-        auto y_idx = y * m_width;
-        for(int x = 1; x < m_width; ++x) {
+    for(int y = 0; y < H; ++y) {
+        auto y_idx = y * W;
+        for(int x = 1; x < W; ++x) {
             auto front = m_cells[x - 1 + y_idx];
             auto back = m_cells[x + y_idx];
 
@@ -371,10 +415,10 @@ double Board::monotonic_score() const {
             }
         }
     }
-    for(int y = 1; y < m_height; ++y) {
-        auto y_idx = y * m_width;
-        for(int x = 0; x < m_width; ++x) {
-            auto front = m_cells[x + y_idx - m_width];
+    for(int y = 1; y < H; ++y) {
+        auto y_idx = y * W;
+        for(int x = 0; x < W; ++x) {
+            auto front = m_cells[x + y_idx - W];
             auto back = m_cells[x + y_idx];
 
             if(front.value == (back.value >> 1) ||
@@ -386,3 +430,8 @@ double Board::monotonic_score() const {
 
     return score;
 }
+
+template class BasicBoard<3, 3>;
+template class BasicBoard<4, 4>;
+template class BasicBoard<5, 5>;
+template class BasicBoard<6, 6>;
@@ -5,11 +5,17 @@
 #include <array>
 #include <cstdint>
 #include <ostream>
-#include <random>
 #include <vector>
 
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
 #include <SFML/System/Vector2.hpp>
 
+#include "Hash.h"
+#include "SpawnRng.h"
+
 enum class ShiftDirection {
     Down = 0,
     Left = 1,
@@ -17,6 +23,49 @@ enum class ShiftDirection {
     Up = 3,
 };
 
+// The bit for dir in a mask of moves.
+inline uint8_t move_bit(ShiftDirection dir) {
+    return 1 << static_cast<int>(dir);
+}
+
+// The outcome of a single move.
+struct MoveResult {
+    // True if any tile moved or merged.
+    bool moved = false;
+    // The sum of the values of all tiles created by merges, which is also
+    // the change in compute_score().
+    uint32_t reward = 0;
+    // The value of the largest tile created by a merge, or 0 if nothing
+    // merged.
+    uint32_t max_merged = 0;
+
+    explicit operator bool() const { return moved; }
+
+    void add_merge(uint32_t value) {
+        reward += value;
+        max_merged = std::max(max_merged, value);
+    }
+};
+
+// The positions reached by each of the four moves from one position, as
+// computed by successors().
+template <typename BoardType>
+struct Successors {
+    // Indexed by ShiftDirection. The board of an illegal move is unchanged.
+    std::array<BoardType, 4> boards;
+    // Bit i is set if ShiftDirection i changes the board.
+    uint8_t legal_mask = 0;
+    // The points earned by the merges of each move.
+    std::array<double, 4> rewards = {};
+
+    bool is_legal(ShiftDirection dir) const {
+        return (legal_mask & move_bit(dir)) != 0;
+    }
+    const BoardType& board(ShiftDirection dir) const {
+        return boards[static_cast<int>(dir)];
+    }
+};
+
 class Cell {
 public:
     static constexpr uint32_t EMPTY = 0;
@@ -34,25 +83,45 @@ public:
     uint32_t value = EMPTY;
 };
 
-class Board {
+// A W x H game board. The dimensions are template parameters so that every
+// loop over the cells has constant bounds, and the compiler can fully
+// unroll the move and scoring code for the common 4x4 board.
+template <int W, int H>
+class BasicBoard {
 public:
-    using VecType = std::array<Cell, 16>;
-    Board(int width, int height, uint64_t seed = 0);
-    ~Board() = default;
-
-    Board(const Board& other) = default;
-    Board(Board&& other) noexcept = default;
-    Board& operator=(const Board& other) = default;
-    Board& operator=(Board&& other) noexcept = default;
-
-    Board clone() const {
-        Board b = *this;
+    static_assert(W > 1 && H > 1, "A board needs at least 2 rows and columns");
+    static_assert(W * H <= 64, "The free cell mask only holds 64 cells");
+
+    static constexpr int WIDTH = W;
+    static constexpr int HEIGHT = H;
+    // A new tile is a 4 one time in SPAWN_FOUR_ONE_IN, and a 2 otherwise.
+    static constexpr int SPAWN_FOUR_ONE_IN = 10;
+    static constexpr double SPAWN_FOUR_PROBABILITY = 1.0 / SPAWN_FOUR_ONE_IN;
+    using VecType = std::array<Cell, W * H>;
+
+    explicit BasicBoard(uint64_t seed = 0);
+    ~BasicBoard() = default;
+
+    BasicBoard(const BasicBoard& other) = default;
+    BasicBoard(BasicBoard&& other) noexcept = default;
+    BasicBoard& operator=(const BasicBoard& other) = default;
+    BasicBoard& operator=(BasicBoard&& other) noexcept = default;
+
+    BasicBoard clone() const {
+        BasicBoard b = *this;
         return b;
     }
 
-    bool shift_board(ShiftDirection dir);
+    MoveResult shift_board(ShiftDirection dir);
     void shift_board_legacy(ShiftDirection dir);
-    bool do_move(ShiftDirection dir);
+    // Shifts the board and spawns a new tile if the move was legal.
+    MoveResult do_move(ShiftDirection dir);
+
+    // Returns a mask of the moves that change the board, see move_bit().
+    // Opposite directions are checked together in a single pass.
+    uint8_t legal_moves() const;
+    // Applies every legal move to a copy of the board.
+    Successors<BasicBoard> successors() const;
 
     double compute_score() const;
     double total_value() const;
@@ -63,18 +132,33 @@ public:
     int free_spaces() const;
     int filled_spaces() const;
     int turn() const { return m_turn; }
+    uint64_t seed() const { return m_seed; }
 
     const Cell& get_cell(int x, int y) const;
-    Cell& get_cell(int x, int y);
     const Cell& get_cell(int idx) const { return m_cells[idx]; }
-    Cell& get_cell(int idx) { return m_cells[idx]; }
-
-    int width() const { return m_width; }
-    int height() const { return m_height; }
-    int total_blocks() const { return width() * height(); }
+    void set_cell(int x, int y, Cell cell) { set_cell(x + y * W, cell); }
+    void set_cell(int idx, Cell cell);
+
+    // Bit i is set if cell i is empty.
+    uint64_t free_mask() const { return m_free_mask; }
+    // A Zobrist hash of the cells. The turn and random state are not part
+    // of the hash.
+    uint64_t hash() const { return m_hash; }
+    // The cells as 4 bit exponents, cell i in bits 4i to 4i + 3, in the
+    // layout of PackedBoard. Tiles past 32768 read as 32768. Always 0 for
+    // boards of more than 16 cells.
+    uint64_t packed_bits() const { return m_packed; }
+    // Returns the index of the n-th empty cell, counting from 0.
+    int nth_free_cell(int n) const;
+
+    static constexpr int width() { return W; }
+    static constexpr int height() { return H; }
+    static constexpr int total_blocks() { return W * H; }
     const VecType& cells() const { return m_cells; }
-    void add_new_block();
-    int get_new_cell_val();
+    // Spawns a tile in a random empty cell. The cell and value depend only
+    // on the seed, the current turn and spawn, which numbers the tiles
+    // spawned in the same turn, such as the two a game starts with.
+    void add_new_block(int spawn = 0);
 
     bool is_filled() const;
     bool is_lost() const;
@@ -82,24 +166,50 @@ public:
 private:
     static sf::Vector2<int> dir_offset(ShiftDirection dir);
     bool merge(Cell& cell1, Cell& cell2);
+    static int get_new_cell_val(SpawnRng& rng);
     double score_for_cell(const Cell& cell) const;
 
-    bool try_merge(Cell& lhs, Cell& rhs);
+    static constexpr uint64_t ALL_CELLS_MASK =
+            W * H == 64 ? ~uint64_t(0) : (uint64_t(1) << (W * H)) - 1;
+    static constexpr ZobristKeys<W * H> ZOBRIST = {};
+
+    static uint64_t zobrist_key(int idx, uint32_t value);
+    // The bits of m_packed for a tile of value in cell idx.
+    static uint64_t packed_key(int idx, uint32_t value);
 
-    bool shift_board_left();
-    bool shift_board_right();
-    bool shift_board_up();
-    bool shift_board_down();
+    template <int Count, int Stride>
+    void shift_line(int first, MoveResult& result);
+    void move_cell(int from, int to);
+    uint32_t merge_cells(int into, int from);
+    void recompute_aggregates();
+    // Sets the cells to the packed exponents in bits, updating the
+    // aggregates only for the cells that differ. Only for the result of a
+    // move, which can not lower the largest tile.
+    void apply_packed(uint64_t bits);
+
+    void shift_board_left(MoveResult& result);
+    void shift_board_right(MoveResult& result);
+    void shift_board_up(MoveResult& result);
+    void shift_board_down(MoveResult& result);
 
 
-    int m_width;
-    int m_height;
     int m_turn = 0;
     VecType m_cells;
-    std::minstd_rand m_rng;
+    uint64_t m_seed;
     bool m_is_lost = false;
+
+    // Aggregates kept up to date by every change to m_cells, so querying
+    // them never needs a scan of the board.
+    double m_score = 0.0;
+    double m_total_value = 0.0;
+    uint32_t m_max_value = 0;
+    uint64_t m_free_mask = ALL_CELLS_MASK;
+    uint64_t m_hash = 0;
+    uint64_t m_packed = 0;
 };
 
+using Board = BasicBoard<4, 4>;
+
 inline uint32_t fast_pow2_log2(uint32_t v) { return __builtin_ctz(v); }
 inline uint64_t fast_pow2_log2(uint64_t v) {
     /*
@@ -123,58 +233,81 @@ inline uint64_t fast_pow2_log2(uint64_t v) {
     return __builtin_ctzl(v);
 }
 
-inline double Board::score_for_cell(const Cell& cell) const {
+// Returns the index of the n-th set bit of mask, counting from 0.
+inline int select_bit(uint64_t mask, int n) {
+#ifdef __BMI2__
+    return __builtin_ctzll(_pdep_u64(uint64_t(1) << n, mask));
+#else
+    for(int i = 0; i < n; ++i) {
+        mask &= mask - 1;
+    }
+    return __builtin_ctzll(mask);
+#endif
+}
+
+template <int W, int H>
+inline double BasicBoard<W, H>::score_for_cell(const Cell& cell) const {
     auto x = cell.value >> 1;
     auto n = fast_pow2_log2(x);
     return 2.0 * x * n;
 }
 
-inline const Cell& Board::get_cell(int x, int y) const {
-    return m_cells[x + y * m_width];
+template <int W, int H>
+inline const Cell& BasicBoard<W, H>::get_cell(int x, int y) const {
+    return m_cells[x + y * W];
 }
-inline Cell& Board::get_cell(int x, int y) { return m_cells[x + y * m_width]; }
-inline double Board::compute_score() const {
-    double val = 0.0;
-    for(std::size_t i = 0; i < m_cells.size(); ++i) {
-        val += score_for_cell(m_cells[i].value);
-    }
-    return val;
+template <int W, int H>
+inline double BasicBoard<W, H>::compute_score() const {
+    return m_score;
 }
 
-inline bool Board::is_filled() const {
-    return std::all_of(m_cells.begin(), m_cells.end(), [](auto& cell) {
-        return cell.value != Cell::EMPTY;
-    });
+template <int W, int H>
+inline bool BasicBoard<W, H>::is_filled() const {
+    return m_free_mask == 0;
 }
-inline bool Board::is_lost() const { return m_is_lost; }
+template <int W, int H>
+inline bool BasicBoard<W, H>::is_lost() const { return m_is_lost; }
 
-inline double Board::total_value() const {
-    double val = 0.0;
-    for(const auto& cell : m_cells) {
-        val += cell.value;
-    }
-    return val;
+template <int W, int H>
+inline double BasicBoard<W, H>::total_value() const {
+    return m_total_value;
 }
 
-inline uint32_t Board::max_value() const {
-    uint32_t val = 0.0;
-    for(const auto& cell : m_cells) {
-        val = std::max(val, cell.value);
-    }
-    return val;
+template <int W, int H>
+inline uint32_t BasicBoard<W, H>::max_value() const {
+    return m_max_value;
+}
+
+template <int W, int H>
+inline int BasicBoard<W, H>::free_spaces() const {
+    return __builtin_popcountll(m_free_mask);
 }
 
-inline int Board::free_spaces() const {
-    int val = 0;
-    for(const auto& cell : m_cells) {
-        if(cell.value == Cell::EMPTY) {
-            val += 1;
+template <int W, int H>
+inline uint64_t BasicBoard<W, H>::zobrist_key(int idx, uint32_t value) {
+    return value == Cell::EMPTY ? 0 : ZOBRIST.keys[idx][fast_pow2_log2(value)];
+}
+
+template <int W, int H>
+inline uint64_t BasicBoard<W, H>::packed_key(int idx, uint32_t value) {
+    if constexpr(W * H > 16) {
+        return 0;
+    } else {
+        if(value == Cell::EMPTY) {
+            return 0;
         }
+        uint64_t exponent = std::min(fast_pow2_log2(value), uint32_t(15));
+        return exponent << (4 * idx);
     }
-    return val;
 }
 
-inline int Board::filled_spaces() const {
+template <int W, int H>
+inline int BasicBoard<W, H>::nth_free_cell(int n) const {
+    return select_bit(m_free_mask, n);
+}
+
+template <int W, int H>
+inline int BasicBoard<W, H>::filled_spaces() const {
     return total_blocks() - free_spaces();
 }
 
@@ -0,0 +1,74 @@
+#include "BoardAllocator.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+
+BoardAllocator::BoardAllocator(std::size_t chunk_bytes)
+        : m_chunk_bytes(chunk_bytes) {}
+
+void BoardAllocator::ChunkDeleter::operator()(std::byte* chunk) const {
+    std::free(chunk);
+}
+
+void BoardAllocator::next_chunk(std::size_t bytes) {
+    // Chunks too small for the allocation are skipped until the next
+    // reset, which only wastes memory when allocations outgrow the chunks.
+    if(m_chunk < m_chunks.size()) {
+        ++m_chunk;
+    }
+    while(m_chunk < m_chunks.size() && m_chunks[m_chunk].size < bytes) {
+        ++m_chunk;
+    }
+    m_offset = 0;
+    if(m_chunk < m_chunks.size()) {
+        return;
+    }
+
+    // aligned_alloc needs the size to be a multiple of the alignment.
+    std::size_t size = std::max(m_chunk_bytes, bytes);
+    size = (size + CACHE_LINE - 1) & ~(CACHE_LINE - 1);
+    void* memory = std::aligned_alloc(CACHE_LINE, size);
+    if(memory == nullptr) {
+        std::abort();
+    }
+    Chunk chunk;
+    chunk.memory.reset(static_cast<std::byte*>(memory));
+    chunk.size = size;
+    m_chunks.push_back(std::move(chunk));
+    m_chunk = m_chunks.size() - 1;
+    m_reserved += size;
+}
+
+void BoardAllocator::reset() {
+    m_chunk = 0;
+    m_offset = 0;
+}
+
+std::size_t BoardAllocator::bytes_used() const {
+    std::size_t used = 0;
+    for(std::size_t i = 0; i < m_chunk && i < m_chunks.size(); ++i) {
+        used += m_chunks[i].size;
+    }
+    return used + m_offset;
+}
+
+BoardAllocator& BoardAllocator::local() {
+    static thread_local BoardAllocator allocator;
+    return allocator;
+}
+
+BoardVector::BoardVector(BoardAllocator& allocator, std::size_t capacity)
+        : m_allocator(&allocator) {
+    reserve(capacity);
+}
+
+void BoardVector::reserve(std::size_t capacity) {
+    if(capacity <= m_capacity) {
+        return;
+    }
+    Board* boards = m_allocator->allocate<Board>(capacity);
+    std::uninitialized_copy(m_boards, m_boards + m_size, boards);
+    m_boards = boards;
+    m_capacity = capacity;
+}
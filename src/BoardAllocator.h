@@ -1,33 +1,189 @@
 #ifndef BOARDALLOCATOR_H_
 #define BOARDALLOCATOR_H_
 
+#include <algorithm>
+#include <cstddef>
 #include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+#include "Board.h"
+
+// Hands out the memory for the nodes of one search by bumping a pointer
+// through large, cache line aligned chunks. Nothing is freed on its own:
+// reset() makes all of the memory available again at once, in constant
+// time, and keeps the chunks for the next search. After the first search
+// has grown the allocator, later ones allocate nothing from the heap.
+//
+// Since nothing is destroyed either, only trivially destructible types can
+// be allocated. Not safe to share between threads, local() gives every
+// thread its own.
+//
+// A recursive search can also give back what a node allocated when the
+// node returns, with a Scope, so that the memory in use is bounded by the
+// depth of the search rather than by its size.
+class BoardAllocator {
+public:
+    static constexpr std::size_t CACHE_LINE = 64;
+
+    // Everything allocated after the scope was opened is freed when it
+    // closes. Scopes must close in the reverse order they were opened.
+    class Scope;
+    static constexpr std::size_t DEFAULT_CHUNK_BYTES = std::size_t(1) << 20;
+
+    explicit BoardAllocator(std::size_t chunk_bytes = DEFAULT_CHUNK_BYTES);
+    ~BoardAllocator() = default;
+
+    BoardAllocator(const BoardAllocator& other) = delete;
+    BoardAllocator(BoardAllocator&& other) noexcept = default;
+    BoardAllocator& operator=(const BoardAllocator& other) = delete;
+    BoardAllocator& operator=(BoardAllocator&& other) noexcept = default;
+
+    // Returns bytes of memory aligned to alignment, which must be a power
+    // of two no larger than CACHE_LINE.
+    void* allocate(std::size_t bytes, std::size_t alignment);
+    // Returns uninitialized memory for count objects of type T.
+    template <typename T>
+    T* allocate(std::size_t count);
+    // Constructs a T from args in the allocator.
+    template <typename T, typename... Args>
+    T* create(Args&&... args);
+
+    // Makes all memory available again. Everything allocated before is
+    // invalid afterwards.
+    void reset();
+    // Frees everything allocated since chunk and offset were the position
+    // of the allocator.
+    void rewind(std::size_t chunk, std::size_t offset);
+
+    // The bytes handed out since the last reset, including padding.
+    std::size_t bytes_used() const;
+    // The bytes of all chunks.
+    std::size_t bytes_reserved() const { return m_reserved; }
+
+    // The allocator of the calling thread, for searches that run on
+    // several threads. Each thread resets its own.
+    static BoardAllocator& local();
+
+private:
+    struct ChunkDeleter {
+        void operator()(std::byte* chunk) const;
+    };
+    struct Chunk {
+        std::unique_ptr<std::byte[], ChunkDeleter> memory;
+        std::size_t size = 0;
+    };
+
+    // Moves on to the next chunk with room for bytes, allocating one if
+    // there is none.
+    void next_chunk(std::size_t bytes);
+
+    std::vector<Chunk> m_chunks;
+    // The chunk being allocated from, and the offset of its free memory.
+    std::size_t m_chunk = 0;
+    std::size_t m_offset = 0;
+    std::size_t m_chunk_bytes;
+    std::size_t m_reserved = 0;
+};
+
+class BoardAllocator::Scope {
+public:
+    explicit Scope(BoardAllocator& allocator)
+            : m_allocator(allocator),
+              m_chunk(allocator.m_chunk),
+              m_offset(allocator.m_offset) {}
+    ~Scope() { m_allocator.rewind(m_chunk, m_offset); }
+
+    Scope(const Scope& other) = delete;
+    Scope(Scope&& other) noexcept = delete;
+    Scope& operator=(const Scope& other) = delete;
+    Scope& operator=(Scope&& other) noexcept = delete;
+
+private:
+    BoardAllocator& m_allocator;
+    std::size_t m_chunk;
+    std::size_t m_offset;
+};
+
+inline void BoardAllocator::rewind(std::size_t chunk, std::size_t offset) {
+    m_chunk = chunk;
+    m_offset = offset;
+}
+
+inline void* BoardAllocator::allocate(
+        std::size_t bytes, std::size_t alignment) {
+    std::size_t offset = (m_offset + alignment - 1) & ~(alignment - 1);
+    if(m_chunk >= m_chunks.size() || offset + bytes > m_chunks[m_chunk].size) {
+        next_chunk(bytes);
+        offset = 0;
+    }
+    m_offset = offset + bytes;
+    return m_chunks[m_chunk].memory.get() + offset;
+}
+
+template <typename T>
+T* BoardAllocator::allocate(std::size_t count) {
+    static_assert(std::is_trivially_destructible_v<T>,
+            "Allocated objects are never destroyed");
+    static_assert(alignof(T) <= CACHE_LINE,
+            "Chunks are only aligned to a cache line");
+    return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+}
+
+template <typename T, typename... Args>
+T* BoardAllocator::create(Args&&... args) {
+    return new(allocate<T>(1)) T(std::forward<Args>(args)...);
+}
+
+// A growable array of boards whose storage comes from a BoardAllocator, so
+// it is released by resetting the allocator rather than by the vector. When
+// it grows, the old storage is left in the allocator until then.
 class BoardVector {
 public:
     BoardVector() = delete;
+    explicit BoardVector(BoardAllocator& allocator, std::size_t capacity = 0);
     ~BoardVector() = default;
 
     BoardVector(const BoardVector& other) = delete;
     BoardVector(BoardVector&& other) noexcept = delete;
     BoardVector& operator=(const BoardVector& other) = delete;
     BoardVector& operator=(BoardVector&& other) noexcept = delete;
-};
 
-class BoardAllocator {
-public:
-    BoardAllocator();
-    ~BoardAllocator() = default;
+    void push_back(const Board& board);
+    void reserve(std::size_t capacity);
+    // Forgets the boards but keeps the storage.
+    void clear() { m_size = 0; }
 
-    BoardAllocator(const BoardAllocator& other) = delete;
-    BoardAllocator(BoardAllocator&& other) noexcept = default;
-    BoardAllocator& operator=(const BoardAllocator& other) = delete;
-    BoardAllocator& operator=(BoardAllocator&& other) noexcept = default;
+    Board& operator[](std::size_t idx) { return m_boards[idx]; }
+    const Board& operator[](std::size_t idx) const { return m_boards[idx]; }
+
+    Board* begin() { return m_boards; }
+    Board* end() { return m_boards + m_size; }
+    const Board* begin() const { return m_boards; }
+    const Board* end() const { return m_boards + m_size; }
+
+    std::size_t size() const { return m_size; }
+    std::size_t capacity() const { return m_capacity; }
+    bool empty() const { return m_size == 0; }
 
 private:
-    int m_capacity;
-    std::vector<uint8_t> elements;
+    static constexpr std::size_t MIN_CAPACITY = 16;
+
+    BoardAllocator* m_allocator;
+    Board* m_boards = nullptr;
+    std::size_t m_size = 0;
+    std::size_t m_capacity = 0;
 };
 
+inline void BoardVector::push_back(const Board& board) {
+    if(m_size == m_capacity) {
+        reserve(std::max(MIN_CAPACITY, 2 * m_capacity));
+    }
+    new(m_boards + m_size) Board(board);
+    ++m_size;
+}
+
 #endif
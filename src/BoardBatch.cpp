@@ -0,0 +1,213 @@
+#include "BoardBatch.h"
+
+#include <algorithm>
+#include <cassert>
+
+// The cells of each line a move operates on, indexed by direction, line and
+// position. Position 0 is the edge the tiles move towards.
+static constexpr int LINE_CELLS[4][4][4] = {
+        // Down
+        {{12, 8, 4, 0}, {13, 9, 5, 1}, {14, 10, 6, 2}, {15, 11, 7, 3}},
+        // Left
+        {{0, 1, 2, 3}, {4, 5, 6, 7}, {8, 9, 10, 11}, {12, 13, 14, 15}},
+        // Right
+        {{3, 2, 1, 0}, {7, 6, 5, 4}, {11, 10, 9, 8}, {15, 14, 13, 12}},
+        // Up
+        {{0, 4, 8, 12}, {1, 5, 9, 13}, {2, 6, 10, 14}, {3, 7, 11, 15}},
+};
+
+// The inverse of LINE_CELLS: for each direction, the index that a cell
+// takes when the board is rotated so the move becomes a left shift.
+struct OrientedCells {
+    int cells[4][16];
+
+    constexpr OrientedCells() : cells() {
+        for(int dir = 0; dir < 4; ++dir) {
+            for(int line = 0; line < 4; ++line) {
+                for(int pos = 0; pos < 4; ++pos) {
+                    cells[dir][LINE_CELLS[dir][line][pos]] = 4 * line + pos;
+                }
+            }
+        }
+    }
+
+    constexpr const int* operator[](int dir) const { return cells[dir]; }
+};
+static constexpr OrientedCells ORIENTED_CELL;
+
+// Moves rhs into lhs if lhs is empty.
+static inline void slide(uint8_t& lhs, uint8_t& rhs) {
+    bool empty = lhs == 0;
+    lhs = empty ? rhs : lhs;
+    rhs = empty ? 0 : rhs;
+}
+
+static inline void merge(
+        uint8_t& lhs, uint8_t& rhs, uint32_t& reward, uint8_t& max_merged) {
+    uint8_t merges = (lhs != 0) & (lhs == rhs) & (lhs != PackedBoard::MAX_EXPONENT);
+    lhs += merges;
+    rhs = merges ? 0 : rhs;
+    reward += uint32_t(merges) << lhs;
+    max_merged = std::max<uint8_t>(max_merged, lhs & -merges);
+}
+
+// Shifts one line towards a. Every step is a select, so the same code runs
+// on all lanes of a vector at once.
+static inline void shift_line(uint8_t& a,
+        uint8_t& b,
+        uint8_t& c,
+        uint8_t& d,
+        uint32_t& reward,
+        uint8_t& max_merged) {
+    // Each pass settles the last cell it touches.
+    slide(a, b);
+    slide(b, c);
+    slide(c, d);
+    slide(a, b);
+    slide(b, c);
+    slide(a, b);
+    // Merging in order keeps a merged tile from merging again, since its
+    // partner is cleared before the next pair is checked.
+    merge(a, b, reward, max_merged);
+    merge(b, c, reward, max_merged);
+    merge(c, d, reward, max_merged);
+    // Merges leave gaps of at most one cell.
+    slide(b, c);
+    slide(c, d);
+}
+
+// Shifts the same line of every board. c0 through c3 are the cells of the
+// line, starting at the edge the tiles move towards.
+static void shift_line_lanes(uint8_t* __restrict c0,
+        uint8_t* __restrict c1,
+        uint8_t* __restrict c2,
+        uint8_t* __restrict c3,
+        uint8_t* __restrict changed,
+        uint32_t* __restrict reward,
+        uint8_t* __restrict max_merged,
+        std::size_t count) {
+    for(std::size_t i = 0; i < count; ++i) {
+        uint8_t a = c0[i], b = c1[i], c = c2[i], d = c3[i];
+        uint32_t line_reward = 0;
+        uint8_t line_max = max_merged[i];
+        shift_line(a, b, c, d, line_reward, line_max);
+        changed[i] |=
+                (a != c0[i]) | (b != c1[i]) | (c != c2[i]) | (d != c3[i]);
+        reward[i] += line_reward;
+        max_merged[i] = line_max;
+        c0[i] = a;
+        c1[i] = b;
+        c2[i] = c;
+        c3[i] = d;
+    }
+}
+
+// Copies the lane of down, left, right or up matching each lane's direction.
+static void select_lanes(uint8_t* __restrict out,
+        const uint8_t* __restrict down,
+        const uint8_t* __restrict left,
+        const uint8_t* __restrict right,
+        const uint8_t* __restrict up,
+        const ShiftDirection* __restrict dirs,
+        std::size_t count) {
+    for(std::size_t i = 0; i < count; ++i) {
+        auto dir = dirs[i];
+        out[i] = dir == ShiftDirection::Down
+                         ? down[i]
+                         : dir == ShiftDirection::Left
+                                   ? left[i]
+                                   : dir == ShiftDirection::Right ? right[i]
+                                                                  : up[i];
+    }
+}
+
+void BoardBatch::reserve(std::size_t count) {
+    for(auto& cells : m_cells) {
+        cells.reserve(count);
+    }
+}
+
+void BoardBatch::clear() {
+    for(auto& cells : m_cells) {
+        cells.clear();
+    }
+}
+
+void BoardBatch::push_back(PackedBoard board) {
+    for(int i = 0; i < PackedBoard::TOTAL_BLOCKS; ++i) {
+        m_cells[i].push_back(board.get_exponent(i));
+    }
+}
+
+PackedBoard BoardBatch::get(std::size_t idx) const {
+    PackedBoard board;
+    for(int i = 0; i < PackedBoard::TOTAL_BLOCKS; ++i) {
+        board.set_exponent(i, m_cells[i][idx]);
+    }
+    return board;
+}
+
+void BoardBatch::set(std::size_t idx, PackedBoard board) {
+    for(int i = 0; i < PackedBoard::TOTAL_BLOCKS; ++i) {
+        m_cells[i][idx] = board.get_exponent(i);
+    }
+}
+
+void BoardBatch::apply(ShiftDirection dir, BatchMoveResult& result) {
+    shift_lines(m_cells, dir, result);
+}
+
+void BoardBatch::apply(
+        const std::vector<ShiftDirection>& dirs, BatchMoveResult& result) {
+    assert(dirs.size() == size());
+    auto count = size();
+
+    // Rotate every board so its move becomes a left shift. Cell 4 * line +
+    // pos of the rotated board is the cell at that line and position of
+    // the board's own direction.
+    for(int line = 0; line < 4; ++line) {
+        for(int pos = 0; pos < 4; ++pos) {
+            auto& out = m_oriented[4 * line + pos];
+            out.resize(count);
+            select_lanes(out.data(),
+                    m_cells[LINE_CELLS[0][line][pos]].data(),
+                    m_cells[LINE_CELLS[1][line][pos]].data(),
+                    m_cells[LINE_CELLS[2][line][pos]].data(),
+                    m_cells[LINE_CELLS[3][line][pos]].data(),
+                    dirs.data(),
+                    count);
+        }
+    }
+
+    shift_lines(m_oriented, ShiftDirection::Left, result);
+
+    // And rotate them back.
+    for(int cell = 0; cell < PackedBoard::TOTAL_BLOCKS; ++cell) {
+        select_lanes(m_cells[cell].data(),
+                m_oriented[ORIENTED_CELL[0][cell]].data(),
+                m_oriented[ORIENTED_CELL[1][cell]].data(),
+                m_oriented[ORIENTED_CELL[2][cell]].data(),
+                m_oriented[ORIENTED_CELL[3][cell]].data(),
+                dirs.data(),
+                count);
+    }
+}
+
+void BoardBatch::shift_lines(
+        CellArrays& cells, ShiftDirection dir, BatchMoveResult& result) {
+    auto count = cells[0].size();
+    result.changed.assign(count, 0);
+    result.reward.assign(count, 0);
+    result.max_merged.assign(count, 0);
+
+    for(const auto& line : LINE_CELLS[static_cast<int>(dir)]) {
+        shift_line_lanes(cells[line[0]].data(),
+                cells[line[1]].data(),
+                cells[line[2]].data(),
+                cells[line[3]].data(),
+                result.changed.data(),
+                result.reward.data(),
+                result.max_merged.data(),
+                count);
+    }
+}
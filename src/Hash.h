@@ -0,0 +1,40 @@
+#ifndef HASH_H_
+#define HASH_H_
+
+#include <cstdint>
+
+// The SplitMix64 finalizer. It is a bijection with good avalanche, so
+// every input bit affects every output bit, which makes it usable as a
+// hash of any 64 bit key.
+constexpr uint64_t mix64(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+// Advances a SplitMix64 generator and returns its next value.
+constexpr uint64_t splitmix64(uint64_t& state) {
+    state += 0x9E3779B97F4A7C15ULL;
+    return mix64(state);
+}
+
+// Random keys for Zobrist hashing a board of Cells cells, indexed by cell
+// and tile exponent. The key of an empty cell (exponent 0) is 0, so empty
+// cells do not need to be hashed.
+template <int Cells>
+struct ZobristKeys {
+    static constexpr int MAX_EXPONENT = 32;
+
+    constexpr ZobristKeys() : keys() {
+        uint64_t state = 2048;
+        for(int i = 0; i < Cells; ++i) {
+            for(int j = 1; j < MAX_EXPONENT; ++j) {
+                keys[i][j] = splitmix64(state);
+            }
+        }
+    }
+
+    uint64_t keys[Cells][MAX_EXPONENT];
+};
+
+#endif
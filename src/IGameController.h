@@ -5,7 +5,9 @@
 
 #include "GameTime.h"
 
-class Board;
+template <int W, int H>
+class BasicBoard;
+using Board = BasicBoard<4, 4>;
 
 class IGameController {
 public:
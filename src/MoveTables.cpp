@@ -0,0 +1,63 @@
+#include "MoveTables.h"
+
+#include <algorithm>
+
+const CachedTable& MoveTables::cache() {
+    static const CachedTable table = CachedTable::load("move_tables",
+            VERSION,
+            sizeof(Data),
+            [](void* data, std::size_t) {
+                generate(*static_cast<Data*>(data));
+            });
+    return table;
+}
+
+void MoveTables::generate(Data& data) {
+    for(int i = 0; i < ROW_COUNT; ++i) {
+        uint16_t row = i;
+        uint16_t rev_row = reverse_row(row);
+
+        uint32_t reward = 0;
+        uint8_t max_merged = 0;
+        uint16_t left = shift_row_left(row, reward, max_merged);
+        uint32_t unused_reward = 0;
+        uint8_t unused_max = 0;
+        uint16_t right = reverse_row(
+                shift_row_left(rev_row, unused_reward, unused_max));
+
+        data.row_left[row] = row ^ left;
+        data.row_right[row] = row ^ right;
+        data.col_up[row] = unpack_col(row) ^ unpack_col(left);
+        data.col_down[row] = unpack_col(row) ^ unpack_col(right);
+        data.merge_reward[row] = reward;
+        data.merge_max[row] = max_merged;
+    }
+}
+
+uint16_t MoveTables::shift_row_left(
+        uint16_t row, uint32_t& reward, uint8_t& max_merged) {
+    int cells[4] = {
+            row & 0xF, (row >> 4) & 0xF, (row >> 8) & 0xF, (row >> 12) & 0xF};
+
+    int out[4] = {0, 0, 0, 0};
+    int out_idx = 0;
+    bool can_merge = false;
+    for(int i = 0; i < 4; ++i) {
+        if(cells[i] == 0) {
+            continue;
+        }
+        if(can_merge && out[out_idx - 1] == cells[i] && cells[i] != 0xF) {
+            out[out_idx - 1] += 1;
+            reward += 1u << out[out_idx - 1];
+            max_merged = std::max<uint8_t>(max_merged, out[out_idx - 1]);
+            // A merged tile can not be merged again in the same move.
+            can_merge = false;
+        } else {
+            out[out_idx] = cells[i];
+            out_idx += 1;
+            can_merge = true;
+        }
+    }
+
+    return out[0] | (out[1] << 4) | (out[2] << 8) | (out[3] << 12);
+}
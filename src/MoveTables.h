@@ -0,0 +1,90 @@
+#ifndef MOVETABLES_H_
+#define MOVETABLES_H_
+
+#include <array>
+#include <cstdint>
+
+#include "TableCache.h"
+
+// Precomputed results of shifting every possible 16 bit packed row.
+//
+// Rows are indexed by their packed value (4 exponents, cell 0 in the low
+// nibble) and store the XOR difference between the row before and after the
+// move, so applying a move to a PackedBoard is a lookup and an XOR per row.
+// The column tables hold the same result spread out over a column of the
+// board, and are indexed by a column of the transposed board.
+//
+// Tiles with exponent 15 (32768) never merge, since the result would not
+// fit in a nibble.
+//
+// The tables are loaded through a CachedTable on first use, so after the
+// first run on a host they are mapped from disk instead of generated.
+class MoveTables {
+public:
+    static constexpr int ROW_COUNT = 65536;
+    // Bumped whenever the generated tables change, which invalidates the
+    // cache files.
+    static constexpr uint64_t VERSION = 1;
+
+    struct Data {
+        // Shift towards cell 0 of the row.
+        std::array<uint16_t, ROW_COUNT> row_left;
+        // Shift towards cell 3 of the row.
+        std::array<uint16_t, ROW_COUNT> row_right;
+        std::array<uint64_t, ROW_COUNT> col_up;
+        std::array<uint64_t, ROW_COUNT> col_down;
+        // The sum of the values of the tiles created by merges, and the
+        // exponent of the largest of them. Both directions along a line
+        // merge the same tiles, so these serve all four moves, with columns
+        // indexed by the transposed board.
+        std::array<uint32_t, ROW_COUNT> merge_reward;
+        std::array<uint8_t, ROW_COUNT> merge_max;
+    };
+
+    // The loaded tables. Safe to call from static initializers. Kernels
+    // take the reference once rather than per lookup.
+    static const Data& data();
+
+    static uint16_t reverse_row(uint16_t row);
+    static uint64_t unpack_col(uint16_t row);
+    static uint64_t transpose(uint64_t board);
+
+    // The storage of the tables, for reporting how they were loaded.
+    static const CachedTable& cache();
+    static void generate(Data& data);
+
+private:
+    static uint16_t shift_row_left(
+            uint16_t row, uint32_t& reward, uint8_t& max_merged);
+};
+
+inline const MoveTables::Data& MoveTables::data() {
+    static const Data& tables = *static_cast<const Data*>(cache().data());
+    return tables;
+}
+
+inline uint16_t MoveTables::reverse_row(uint16_t row) {
+    return (row >> 12) | ((row >> 4) & 0x00F0) | ((row << 4) & 0x0F00) |
+           (row << 12);
+}
+
+// Places nibble n of row into nibble 4 * n, giving column 0 of a board.
+inline uint64_t MoveTables::unpack_col(uint16_t row) {
+    uint64_t tmp = row;
+    return (tmp | (tmp << 12) | (tmp << 24) | (tmp << 36)) &
+           0x000F000F000F000FULL;
+}
+
+// Swaps cell (x, y) with cell (y, x).
+inline uint64_t MoveTables::transpose(uint64_t board) {
+    uint64_t a1 = board & 0xF0F00F0FF0F00F0FULL;
+    uint64_t a2 = board & 0x0000F0F00000F0F0ULL;
+    uint64_t a3 = board & 0x0F0F00000F0F0000ULL;
+    uint64_t a = a1 | (a2 << 12) | (a3 >> 12);
+    uint64_t b1 = a & 0xFF00FF0000FF00FFULL;
+    uint64_t b2 = a & 0x00FF00FF00000000ULL;
+    uint64_t b3 = a & 0x00000000FF00FF00ULL;
+    return b1 | (b2 >> 24) | (b3 << 24);
+}
+
+#endif
@@ -0,0 +1,33 @@
+#include "PackedBoard.h"
+
+#include <cassert>
+
+PackedBoard::PackedBoard(const Board& board) {
+    assert(can_pack(board));
+    for(int i = 0; i < TOTAL_BLOCKS; ++i) {
+        m_bits |= uint64_t(value_to_exponent(board.get_cell(i).value))
+                  << (4 * i);
+    }
+}
+
+bool PackedBoard::can_pack(const Board& board) {
+    static_assert(Board::WIDTH == WIDTH && Board::HEIGHT == HEIGHT,
+            "PackedBoard only supports 4x4 boards");
+    return board.max_value() <= MAX_VALUE;
+}
+
+void PackedBoard::unpack(Board& board) const {
+    for(int i = 0; i < TOTAL_BLOCKS; ++i) {
+        board.set_cell(i, Cell(get_value(i)));
+    }
+}
+
+std::ostream& operator<<(std::ostream& stream, const PackedBoard& board) {
+    for(int y = 0; y < PackedBoard::HEIGHT; ++y) {
+        for(int x = 0; x < PackedBoard::WIDTH; ++x) {
+            stream << board.get_value(x, y);
+            stream << (x == PackedBoard::WIDTH - 1 ? '\n' : '\t');
+        }
+    }
+    return stream;
+}
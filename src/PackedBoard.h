@@ -0,0 +1,261 @@
+#ifndef PACKEDBOARD_H_
+#define PACKEDBOARD_H_
+
+#include <algorithm>
+#include <cstdint>
+
+#include "Board.h"
+#include "Hash.h"
+#include "MoveTables.h"
+#include "SimdBoard.h"
+
+// The kernels a PackedBoard can compute moves with.
+enum class MoveKernel {
+    Tables,
+    Simd,
+};
+
+// A compact 4x4 board that fits in a single register.
+//
+// Each cell is stored as a 4 bit exponent, where 0 is an empty cell and n is
+// a tile with value 2^n, so tiles up to 32768 can be represented. Cell
+// (x, y) lives in the nibble starting at bit 4 * (x + 4 * y), which makes
+// every row of the board a single 16 bit word.
+class PackedBoard {
+public:
+    static constexpr int WIDTH = 4;
+    static constexpr int HEIGHT = 4;
+    static constexpr int TOTAL_BLOCKS = WIDTH * HEIGHT;
+    static constexpr int MAX_EXPONENT = 15;
+    static constexpr uint32_t MAX_VALUE = 1u << MAX_EXPONENT;
+
+    PackedBoard() = default;
+    explicit PackedBoard(uint64_t bits) : m_bits(bits) {}
+    explicit PackedBoard(const Board& board);
+    ~PackedBoard() = default;
+
+    PackedBoard(const PackedBoard& other) = default;
+    PackedBoard(PackedBoard&& other) noexcept = default;
+    PackedBoard& operator=(const PackedBoard& other) = default;
+    PackedBoard& operator=(PackedBoard&& other) noexcept = default;
+
+    // Returns true if every cell of the board can be stored without loss.
+    static bool can_pack(const Board& board);
+    // Writes the cells back into board. The turn counter and the random
+    // state of board are left untouched.
+    void unpack(Board& board) const;
+
+    uint64_t bits() const { return m_bits; }
+    // A well distributed hash of the position, cheap enough to compute at
+    // every search node.
+    uint64_t hash() const { return mix64(m_bits); }
+
+    int get_exponent(int idx) const { return (m_bits >> (4 * idx)) & 0xF; }
+    int get_exponent(int x, int y) const { return get_exponent(x + y * WIDTH); }
+    uint32_t get_value(int idx) const;
+    uint32_t get_value(int x, int y) const { return get_value(x + y * WIDTH); }
+
+    void set_exponent(int idx, int exponent);
+    void set_value(int idx, uint32_t value);
+
+    uint16_t row(int y) const { return (m_bits >> (16 * y)) & 0xFFFF; }
+
+    int free_spaces() const { return __builtin_popcountll(free_nibbles()); }
+    // Bit i is set if cell i is empty.
+    uint16_t free_mask() const;
+    // Returns the index of the n-th empty cell, counting from 0.
+    int nth_free_cell(int n) const { return select_bit(free_nibbles(), n) / 4; }
+
+    // Shifts the board in dir using the precomputed move tables.
+    MoveResult shift(ShiftDirection dir);
+    // Shifts the board with the given kernel, falling back to the tables if
+    // the SIMD kernel was not compiled in.
+    MoveResult shift(ShiftDirection dir, MoveKernel kernel);
+
+    // Applies all four moves at once. Left and right share the row
+    // extraction, and up and down share a single transpose.
+    Successors<PackedBoard> successors() const;
+    uint8_t legal_moves() const { return successors().legal_mask; }
+
+    bool operator==(const PackedBoard& rhs) const {
+        return m_bits == rhs.m_bits;
+    }
+    bool operator!=(const PackedBoard& rhs) const {
+        return m_bits != rhs.m_bits;
+    }
+
+    static int value_to_exponent(uint32_t value) {
+        return value == Cell::EMPTY ? 0 : fast_pow2_log2(value);
+    }
+    static uint32_t exponent_to_value(int exponent) {
+        return exponent == 0 ? Cell::EMPTY : 1u << exponent;
+    }
+
+private:
+    // Returns a mask with the lowest bit of every empty nibble set.
+    uint64_t free_nibbles() const;
+
+    static uint64_t shift_rows(
+            uint64_t bits, const std::array<uint16_t, 65536>& table);
+    // transposed must be MoveTables::transpose(bits).
+    static uint64_t shift_cols(uint64_t bits,
+            uint64_t transposed,
+            const std::array<uint64_t, 65536>& table);
+    // Adds the merges of the four rows of lines to result.
+    static void add_merges(uint64_t lines, MoveResult& result);
+
+    uint64_t m_bits = 0;
+};
+
+inline uint32_t PackedBoard::get_value(int idx) const {
+    return exponent_to_value(get_exponent(idx));
+}
+
+inline void PackedBoard::set_exponent(int idx, int exponent) {
+    auto shift = 4 * idx;
+    m_bits = (m_bits & ~(uint64_t(0xF) << shift)) |
+             (uint64_t(exponent & 0xF) << shift);
+}
+
+inline void PackedBoard::set_value(int idx, uint32_t value) {
+    set_exponent(idx, value_to_exponent(value));
+}
+
+inline uint64_t PackedBoard::free_nibbles() const {
+    uint64_t bits = m_bits;
+    bits |= bits >> 2;
+    bits |= bits >> 1;
+    return ~bits & 0x1111111111111111ULL;
+}
+
+inline uint16_t PackedBoard::free_mask() const {
+#ifdef __BMI2__
+    return _pext_u64(free_nibbles(), 0x1111111111111111ULL);
+#else
+    uint16_t mask = 0;
+    for(auto free = free_nibbles(); free != 0; free &= free - 1) {
+        mask |= 1 << (__builtin_ctzll(free) / 4);
+    }
+    return mask;
+#endif
+}
+
+inline uint64_t PackedBoard::shift_rows(
+        uint64_t bits, const std::array<uint16_t, 65536>& table) {
+    uint64_t result = bits;
+    result ^= uint64_t(table[bits & 0xFFFF]);
+    result ^= uint64_t(table[(bits >> 16) & 0xFFFF]) << 16;
+    result ^= uint64_t(table[(bits >> 32) & 0xFFFF]) << 32;
+    result ^= uint64_t(table[(bits >> 48) & 0xFFFF]) << 48;
+    return result;
+}
+
+inline uint64_t PackedBoard::shift_cols(uint64_t bits,
+        uint64_t transposed,
+        const std::array<uint64_t, 65536>& table) {
+    // Each row of the transposed board is a column of the original.
+    uint64_t t = transposed;
+    uint64_t result = bits;
+    result ^= table[t & 0xFFFF];
+    result ^= table[(t >> 16) & 0xFFFF] << 4;
+    result ^= table[(t >> 32) & 0xFFFF] << 8;
+    result ^= table[(t >> 48) & 0xFFFF] << 12;
+    return result;
+}
+
+inline void PackedBoard::add_merges(uint64_t lines, MoveResult& result) {
+    const auto& tables = MoveTables::data();
+    uint8_t max_merged = 0;
+    for(int i = 0; i < 4; ++i) {
+        uint16_t line = (lines >> (16 * i)) & 0xFFFF;
+        result.reward += tables.merge_reward[line];
+        max_merged = std::max(max_merged, tables.merge_max[line]);
+    }
+    result.max_merged = max_merged == 0 ? 0 : exponent_to_value(max_merged);
+}
+
+inline MoveResult PackedBoard::shift(ShiftDirection dir) {
+    const auto& tables = MoveTables::data();
+    MoveResult result;
+    uint64_t bits = m_bits;
+    uint64_t transposed = 0;
+    switch(dir) {
+    case ShiftDirection::Left:
+        bits = shift_rows(m_bits, tables.row_left);
+        add_merges(m_bits, result);
+        break;
+    case ShiftDirection::Right:
+        bits = shift_rows(m_bits, tables.row_right);
+        add_merges(m_bits, result);
+        break;
+    case ShiftDirection::Up:
+        transposed = MoveTables::transpose(m_bits);
+        bits = shift_cols(m_bits, transposed, tables.col_up);
+        add_merges(transposed, result);
+        break;
+    case ShiftDirection::Down:
+        transposed = MoveTables::transpose(m_bits);
+        bits = shift_cols(m_bits, transposed, tables.col_down);
+        add_merges(transposed, result);
+        break;
+    }
+    result.moved = bits != m_bits;
+    m_bits = bits;
+    return result;
+}
+
+inline MoveResult PackedBoard::shift(ShiftDirection dir, MoveKernel kernel) {
+#ifdef SIMD_BOARD_AVAILABLE
+    if(kernel == MoveKernel::Simd) {
+        auto board = SimdBoard::from_packed(m_bits);
+        auto result = board.shift(dir);
+        m_bits = board.to_packed();
+        return result;
+    }
+#endif
+    return shift(dir);
+}
+
+inline Successors<PackedBoard> PackedBoard::successors() const {
+    const auto& tables = MoveTables::data();
+    uint64_t left = m_bits;
+    uint64_t right = m_bits;
+    uint32_t row_reward = 0;
+    for(int y = 0; y < HEIGHT; ++y) {
+        uint16_t line = row(y);
+        left ^= uint64_t(tables.row_left[line]) << (16 * y);
+        right ^= uint64_t(tables.row_right[line]) << (16 * y);
+        row_reward += tables.merge_reward[line];
+    }
+
+    uint64_t transposed = MoveTables::transpose(m_bits);
+    uint64_t up = m_bits;
+    uint64_t down = m_bits;
+    uint32_t col_reward = 0;
+    for(int x = 0; x < WIDTH; ++x) {
+        uint16_t line = (transposed >> (16 * x)) & 0xFFFF;
+        up ^= tables.col_up[line] << (4 * x);
+        down ^= tables.col_down[line] << (4 * x);
+        col_reward += tables.merge_reward[line];
+    }
+
+    Successors<PackedBoard> out;
+    out.boards = {PackedBoard(down),
+            PackedBoard(left),
+            PackedBoard(right),
+            PackedBoard(up)};
+    out.rewards = {static_cast<double>(col_reward),
+            static_cast<double>(row_reward),
+            static_cast<double>(row_reward),
+            static_cast<double>(col_reward)};
+    for(int i = 0; i < 4; ++i) {
+        if(out.boards[i] != *this) {
+            out.legal_mask |= 1 << i;
+        }
+    }
+    return out;
+}
+
+std::ostream& operator<<(std::ostream& stream, const PackedBoard& board);
+
+#endif
@@ -0,0 +1,30 @@
+#include "SimdBoard.h"
+
+#ifdef SIMD_BOARD_AVAILABLE
+
+#include <array>
+
+SimdBoard::SimdBoard(const Board& board) {
+    alignas(16) std::array<uint8_t, 16> exponents = {};
+    for(int i = 0; i < board.total_blocks(); ++i) {
+        auto value = board.get_cell(i).value;
+        exponents[i] = value == Cell::EMPTY ? 0 : fast_pow2_log2(value);
+    }
+    m_cells = _mm_load_si128(reinterpret_cast<const __m128i*>(exponents.data()));
+}
+
+bool SimdBoard::is_supported() {
+#ifdef _MSC_VER
+    return true;
+#else
+    return __builtin_cpu_supports("ssse3");
+#endif
+}
+
+int SimdBoard::get_exponent(int idx) const {
+    alignas(16) std::array<uint8_t, 16> exponents;
+    _mm_store_si128(reinterpret_cast<__m128i*>(exponents.data()), m_cells);
+    return exponents[idx];
+}
+
+#endif
@@ -0,0 +1,197 @@
+#ifndef SIMDBOARD_H_
+#define SIMDBOARD_H_
+
+#include <cstdint>
+
+#if defined(__SSSE3__) || defined(_MSC_VER)
+#define SIMD_BOARD_AVAILABLE 1
+#include <immintrin.h>
+#endif
+
+#include "Board.h"
+
+#ifdef SIMD_BOARD_AVAILABLE
+
+// A 4x4 board held in a single SSE register, with one tile exponent per
+// byte. Cell (x, y) is byte x + 4 * y, so each row is one 32 bit lane.
+//
+// Moves are computed for all four rows at once with in-register shifts and
+// byte shuffles, and need no lookup tables. This keeps the L1 cache free
+// for other work when many search threads share a core, at the cost of a
+// few more instructions per move than the table kernel.
+//
+// To agree with PackedBoard, tiles with exponent 15 never merge.
+class SimdBoard {
+public:
+    static constexpr int MAX_EXPONENT = 15;
+
+    SimdBoard() : m_cells(_mm_setzero_si128()) {}
+    explicit SimdBoard(__m128i cells) : m_cells(cells) {}
+    explicit SimdBoard(const Board& board);
+    ~SimdBoard() = default;
+
+    SimdBoard(const SimdBoard& other) = default;
+    SimdBoard(SimdBoard&& other) noexcept = default;
+    SimdBoard& operator=(const SimdBoard& other) = default;
+    SimdBoard& operator=(SimdBoard&& other) noexcept = default;
+
+    // Returns true if the CPU running the program supports the kernel.
+    static bool is_supported();
+
+    static SimdBoard from_packed(uint64_t bits);
+    uint64_t to_packed() const;
+
+    __m128i cells() const { return m_cells; }
+    int get_exponent(int idx) const;
+
+    // Shifts the board in dir.
+    MoveResult shift(ShiftDirection dir);
+
+private:
+    static __m128i compact_left(__m128i cells);
+    // merged receives the exponent of each tile created by a merge, and 0
+    // in every other byte.
+    static __m128i shift_left(__m128i cells, __m128i& merged);
+    static void add_merges(__m128i merged, MoveResult& result);
+
+    __m128i m_cells;
+};
+
+// Moves every non-empty cell towards the start of its row, preserving order.
+//
+// Each cell moves left by the number of empty cells before it in the row.
+// The move is split into a one cell step and a two cell step, which can
+// never collide because the distances only grow along a row.
+inline __m128i SimdBoard::compact_left(__m128i cells) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+    const __m128i two = _mm_set1_epi8(2);
+
+    __m128i empty = _mm_cmpeq_epi8(cells, zero);
+    __m128i dist = _mm_and_si128(empty, one);
+    dist = _mm_add_epi8(dist, _mm_slli_epi32(dist, 8));
+    dist = _mm_add_epi8(dist, _mm_slli_epi32(dist, 16));
+    dist = _mm_andnot_si128(empty, dist);
+
+    __m128i step = _mm_cmpeq_epi8(_mm_and_si128(dist, one), one);
+    cells = _mm_or_si128(_mm_andnot_si128(step, cells),
+            _mm_srli_epi32(_mm_and_si128(step, cells), 8));
+    dist = _mm_or_si128(_mm_andnot_si128(step, dist),
+            _mm_srli_epi32(_mm_and_si128(step, dist), 8));
+
+    step = _mm_cmpeq_epi8(_mm_and_si128(dist, two), two);
+    cells = _mm_or_si128(_mm_andnot_si128(step, cells),
+            _mm_srli_epi32(_mm_and_si128(step, cells), 16));
+    return cells;
+}
+
+inline __m128i SimdBoard::shift_left(__m128i cells, __m128i& merged) {
+    cells = compact_left(cells);
+
+    // Find cells equal to their right neighbor. A merged cell can not merge
+    // again, so of a run of equal cells only every other pair merges.
+    __m128i blocked = _mm_or_si128(_mm_cmpeq_epi8(cells, _mm_setzero_si128()),
+            _mm_cmpeq_epi8(cells, _mm_set1_epi8(MAX_EXPONENT)));
+    __m128i equal = _mm_andnot_si128(
+            blocked, _mm_cmpeq_epi8(cells, _mm_srli_epi32(cells, 8)));
+    __m128i merge = _mm_andnot_si128(_mm_slli_epi32(equal, 8), equal);
+    merge = _mm_andnot_si128(_mm_slli_epi32(merge, 8), equal);
+
+    // The merge mask is -1 per merging byte, so subtracting it bumps the
+    // exponent, and the right partner of each merge is cleared.
+    cells = _mm_sub_epi8(cells, merge);
+    cells = _mm_andnot_si128(_mm_slli_epi32(merge, 8), cells);
+    merged = _mm_and_si128(merge, cells);
+
+    return compact_left(cells);
+}
+
+// The order of the bytes in merged does not matter, so this works on the
+// board before it is shuffled back.
+inline void SimdBoard::add_merges(__m128i merged, MoveResult& result) {
+    // The low and high byte of 2^e, for every exponent a merge can create.
+    const __m128i pow_lo = _mm_setr_epi8(
+            0, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i pow_hi = _mm_setr_epi8(
+            0, 0, 0, 0, 0, 0, 0, 0, 1, 2, 4, 8, 16, 32, 64, -128);
+    const __m128i zero = _mm_setzero_si128();
+
+    __m128i sum_lo = _mm_sad_epu8(_mm_shuffle_epi8(pow_lo, merged), zero);
+    __m128i sum_hi = _mm_sad_epu8(_mm_shuffle_epi8(pow_hi, merged), zero);
+    __m128i sum = _mm_add_epi64(sum_lo, _mm_slli_epi64(sum_hi, 8));
+    sum = _mm_add_epi64(sum, _mm_unpackhi_epi64(sum, sum));
+    result.reward += _mm_cvtsi128_si32(sum);
+
+    __m128i max = _mm_max_epu8(merged, _mm_srli_si128(merged, 8));
+    max = _mm_max_epu8(max, _mm_srli_si128(max, 4));
+    max = _mm_max_epu8(max, _mm_srli_si128(max, 2));
+    max = _mm_max_epu8(max, _mm_srli_si128(max, 1));
+    int max_exponent = _mm_cvtsi128_si32(max) & 0xFF;
+    result.max_merged = max_exponent == 0 ? 0 : 1u << max_exponent;
+}
+
+inline MoveResult SimdBoard::shift(ShiftDirection dir) {
+    // Every direction is turned into a left shift by a byte shuffle, and
+    // shuffled back afterwards.
+    const __m128i reverse =
+            _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    const __m128i transpose =
+            _mm_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+    const __m128i down =
+            _mm_setr_epi8(12, 8, 4, 0, 13, 9, 5, 1, 14, 10, 6, 2, 15, 11, 7, 3);
+    const __m128i down_inverse =
+            _mm_setr_epi8(3, 7, 11, 15, 2, 6, 10, 14, 1, 5, 9, 13, 0, 4, 8, 12);
+
+    __m128i result;
+    __m128i merged = _mm_setzero_si128();
+    switch(dir) {
+    case ShiftDirection::Left:
+        result = shift_left(m_cells, merged);
+        break;
+    case ShiftDirection::Right:
+        result = _mm_shuffle_epi8(
+                shift_left(_mm_shuffle_epi8(m_cells, reverse), merged),
+                reverse);
+        break;
+    case ShiftDirection::Up:
+        result = _mm_shuffle_epi8(
+                shift_left(_mm_shuffle_epi8(m_cells, transpose), merged),
+                transpose);
+        break;
+    case ShiftDirection::Down:
+        result = _mm_shuffle_epi8(
+                shift_left(_mm_shuffle_epi8(m_cells, down), merged),
+                down_inverse);
+        break;
+    default:
+        result = m_cells;
+        break;
+    }
+
+    MoveResult move;
+    move.moved = _mm_movemask_epi8(_mm_cmpeq_epi8(result, m_cells)) != 0xFFFF;
+    add_merges(merged, move);
+    m_cells = result;
+    return move;
+}
+
+inline SimdBoard SimdBoard::from_packed(uint64_t bits) {
+    // Byte n of lo holds cell 2n, and byte n of hi holds cell 2n + 1.
+    uint64_t lo = bits & 0x0F0F0F0F0F0F0F0FULL;
+    uint64_t hi = (bits >> 4) & 0x0F0F0F0F0F0F0F0FULL;
+    return SimdBoard(_mm_unpacklo_epi8(_mm_cvtsi64_si128(lo),
+            _mm_cvtsi64_si128(hi)));
+}
+
+inline uint64_t SimdBoard::to_packed() const {
+    // Combine neighboring bytes into one nibble pair per 16 bit word, then
+    // narrow the words back down to bytes.
+    const __m128i weights =
+            _mm_setr_epi8(1, 16, 1, 16, 1, 16, 1, 16, 1, 16, 1, 16, 1, 16, 1, 16);
+    __m128i pairs = _mm_maddubs_epi16(m_cells, weights);
+    return _mm_cvtsi128_si64(_mm_packus_epi16(pairs, pairs));
+}
+
+#endif
+
+#endif
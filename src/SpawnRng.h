@@ -0,0 +1,50 @@
+#ifndef SPAWNRNG_H_
+#define SPAWNRNG_H_
+
+#include <cstdint>
+
+#include "Hash.h"
+
+// A counter based random stream for tile spawns.
+//
+// The stream is derived only from a game seed and a counter (the turn and
+// the number of the spawn within it, see Board::add_new_block), so it
+// holds no state between spawns: copies of a board do not carry generator
+// state, a game replays identically from any turn, and the result does not
+// depend on which thread or how many copies came first.
+class SpawnRng {
+public:
+    SpawnRng(uint64_t seed, uint64_t counter)
+        : m_state(mix64(mix64(seed) ^ counter)) {}
+    ~SpawnRng() = default;
+
+    SpawnRng(const SpawnRng& other) = default;
+    SpawnRng(SpawnRng&& other) noexcept = default;
+    SpawnRng& operator=(const SpawnRng& other) = default;
+    SpawnRng& operator=(SpawnRng&& other) noexcept = default;
+
+    uint64_t next() { return splitmix64(m_state); }
+
+    // Returns a value uniformly distributed in [0, bound).
+    uint32_t uniform(uint32_t bound);
+
+private:
+    uint64_t m_state;
+};
+
+// Lemire's multiply and shift reduction, rejecting the few low products
+// that would make some results more likely than others.
+inline uint32_t SpawnRng::uniform(uint32_t bound) {
+    uint64_t product = (next() & 0xFFFFFFFF) * bound;
+    uint32_t low = static_cast<uint32_t>(product);
+    if(low < bound) {
+        uint32_t threshold = -bound % bound;
+        while(low < threshold) {
+            product = (next() & 0xFFFFFFFF) * bound;
+            low = static_cast<uint32_t>(product);
+        }
+    }
+    return product >> 32;
+}
+
+#endif
@@ -0,0 +1,175 @@
+#include "Symmetry.h"
+
+#include "MoveTables.h"
+
+static uint64_t mirror_x(uint64_t bits) {
+    bits = ((bits & 0x0F0F0F0F0F0F0F0FULL) << 4) |
+           ((bits >> 4) & 0x0F0F0F0F0F0F0F0FULL);
+    return ((bits & 0x00FF00FF00FF00FFULL) << 8) |
+           ((bits >> 8) & 0x00FF00FF00FF00FFULL);
+}
+
+static uint64_t mirror_y(uint64_t bits) {
+    bits = ((bits & 0x0000FFFF0000FFFFULL) << 16) |
+           ((bits >> 16) & 0x0000FFFF0000FFFFULL);
+    return (bits << 32) | (bits >> 32);
+}
+
+PackedBoard apply_symmetry(PackedBoard board, Symmetry sym) {
+    uint64_t bits = board.bits();
+    // Every symmetry is an optional transpose followed by optional mirrors.
+    switch(sym) {
+    case Symmetry::Identity:
+        break;
+    case Symmetry::MirrorX:
+        bits = mirror_x(bits);
+        break;
+    case Symmetry::MirrorY:
+        bits = mirror_y(bits);
+        break;
+    case Symmetry::Rotate180:
+        bits = mirror_x(mirror_y(bits));
+        break;
+    case Symmetry::Transpose:
+        bits = MoveTables::transpose(bits);
+        break;
+    case Symmetry::RotateCw:
+        bits = mirror_x(MoveTables::transpose(bits));
+        break;
+    case Symmetry::RotateCcw:
+        bits = mirror_y(MoveTables::transpose(bits));
+        break;
+    case Symmetry::AntiTranspose:
+        bits = mirror_x(mirror_y(MoveTables::transpose(bits)));
+        break;
+    }
+    return PackedBoard(bits);
+}
+
+ShiftDirection apply_symmetry(ShiftDirection dir, Symmetry sym) {
+    int dx = 0;
+    int dy = 0;
+    switch(dir) {
+    case ShiftDirection::Down:
+        dy = 1;
+        break;
+    case ShiftDirection::Left:
+        dx = -1;
+        break;
+    case ShiftDirection::Right:
+        dx = 1;
+        break;
+    case ShiftDirection::Up:
+        dy = -1;
+        break;
+    }
+
+    // Directions only see the linear part of the transform.
+    int new_dx = dx;
+    int new_dy = dy;
+    switch(sym) {
+    case Symmetry::Identity:
+        break;
+    case Symmetry::MirrorX:
+        new_dx = -dx;
+        break;
+    case Symmetry::MirrorY:
+        new_dy = -dy;
+        break;
+    case Symmetry::Rotate180:
+        new_dx = -dx;
+        new_dy = -dy;
+        break;
+    case Symmetry::Transpose:
+        new_dx = dy;
+        new_dy = dx;
+        break;
+    case Symmetry::RotateCw:
+        new_dx = -dy;
+        new_dy = dx;
+        break;
+    case Symmetry::RotateCcw:
+        new_dx = dy;
+        new_dy = -dx;
+        break;
+    case Symmetry::AntiTranspose:
+        new_dx = -dy;
+        new_dy = -dx;
+        break;
+    }
+
+    if(new_dx < 0) {
+        return ShiftDirection::Left;
+    } else if(new_dx > 0) {
+        return ShiftDirection::Right;
+    } else if(new_dy < 0) {
+        return ShiftDirection::Up;
+    } else {
+        return ShiftDirection::Down;
+    }
+}
+
+Symmetry inverse(Symmetry sym) {
+    switch(sym) {
+    case Symmetry::RotateCw:
+        return Symmetry::RotateCcw;
+    case Symmetry::RotateCcw:
+        return Symmetry::RotateCw;
+    default:
+        // Everything else is its own inverse.
+        return sym;
+    }
+}
+
+CanonicalBoard canonicalize(PackedBoard board) {
+    uint64_t bits = board.bits();
+    uint64_t transposed = MoveTables::transpose(bits);
+    uint64_t images[8] = {
+            bits,
+            mirror_x(bits),
+            mirror_y(bits),
+            mirror_x(mirror_y(bits)),
+            transposed,
+            mirror_x(transposed),
+            mirror_y(transposed),
+            mirror_x(mirror_y(transposed)),
+    };
+
+    int best = 0;
+    for(int i = 1; i < 8; ++i) {
+        if(images[i] < images[best]) {
+            best = i;
+        }
+    }
+    return {PackedBoard(images[best]), static_cast<Symmetry>(best)};
+}
+
+std::ostream& operator<<(std::ostream& stream, Symmetry sym) {
+    switch(sym) {
+    case Symmetry::Identity:
+        stream << "Identity";
+        break;
+    case Symmetry::MirrorX:
+        stream << "MirrorX";
+        break;
+    case Symmetry::MirrorY:
+        stream << "MirrorY";
+        break;
+    case Symmetry::Rotate180:
+        stream << "Rotate180";
+        break;
+    case Symmetry::Transpose:
+        stream << "Transpose";
+        break;
+    case Symmetry::RotateCw:
+        stream << "RotateCw";
+        break;
+    case Symmetry::RotateCcw:
+        stream << "RotateCcw";
+        break;
+    case Symmetry::AntiTranspose:
+        stream << "AntiTranspose";
+        break;
+    }
+    return stream;
+}
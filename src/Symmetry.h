@@ -0,0 +1,41 @@
+#ifndef SYMMETRY_H_
+#define SYMMETRY_H_
+
+#include <ostream>
+
+#include "Board.h"
+#include "PackedBoard.h"
+
+// The 8 rotations and reflections of a square board. Each maps cell (x, y)
+// of a 4x4 board to the cell given in its comment.
+enum class Symmetry {
+    Identity = 0,      // (x, y)
+    MirrorX = 1,       // (3 - x, y)
+    MirrorY = 2,       // (x, 3 - y)
+    Rotate180 = 3,     // (3 - x, 3 - y)
+    Transpose = 4,     // (y, x)
+    RotateCw = 5,      // (3 - y, x)
+    RotateCcw = 6,     // (y, 3 - x)
+    AntiTranspose = 7, // (3 - y, 3 - x)
+};
+
+// A board in canonical form, along with the symmetry that maps the original
+// board onto it.
+struct CanonicalBoard {
+    PackedBoard board;
+    Symmetry transform;
+};
+
+PackedBoard apply_symmetry(PackedBoard board, Symmetry sym);
+// Maps a move on a board to the equivalent move on the transformed board.
+ShiftDirection apply_symmetry(ShiftDirection dir, Symmetry sym);
+Symmetry inverse(Symmetry sym);
+
+// Returns the smallest of the 8 symmetric images of board. Symmetric
+// boards share a canonical form, so it can be used as a cache key; moves
+// found for the canonical board map back with inverse(transform).
+CanonicalBoard canonicalize(PackedBoard board);
+
+std::ostream& operator<<(std::ostream& stream, Symmetry sym);
+
+#endif
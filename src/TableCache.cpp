@@ -0,0 +1,271 @@
+#include "TableCache.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <vector>
+
+#include "Hash.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define TABLE_CACHE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Bumped whenever the file layout changes.
+static constexpr uint32_t FORMAT_VERSION = 2;
+static constexpr char MAGIC[8] = {'2', '0', '4', '8', 'T', 'B', 'L', '\0'};
+
+// Starts every cache file. The table data follows directly, so the header
+// size keeps it aligned for any element type.
+struct FileHeader {
+    char magic[8];
+    uint32_t format_version;
+    uint32_t header_size;
+    uint64_t key;
+    uint64_t size;
+    // Of the table data, see checksum().
+    uint64_t checksum;
+    uint8_t padding[24];
+};
+static_assert(sizeof(FileHeader) == 64, "The header must keep data aligned");
+
+class CachedTable::Storage {
+public:
+    explicit Storage(std::size_t size) : m_memory(size) {}
+#ifdef TABLE_CACHE_MMAP
+    Storage(void* mapping, std::size_t length)
+            : m_mapping(mapping), m_mapping_length(length) {}
+#endif
+    ~Storage() {
+#ifdef TABLE_CACHE_MMAP
+        if(m_mapping != nullptr) {
+            munmap(m_mapping, m_mapping_length);
+        }
+#endif
+    }
+
+    Storage(const Storage& other) = delete;
+    Storage(Storage&& other) noexcept = delete;
+    Storage& operator=(const Storage& other) = delete;
+    Storage& operator=(Storage&& other) noexcept = delete;
+
+    const void* data() const {
+        if(m_mapping != nullptr) {
+            return static_cast<const char*>(m_mapping) + sizeof(FileHeader);
+        }
+        return m_memory.data();
+    }
+    void* memory() { return m_memory.data(); }
+    bool is_mapped() const { return m_mapping != nullptr; }
+
+private:
+    std::vector<char> m_memory;
+    void* m_mapping = nullptr;
+    std::size_t m_mapping_length = 0;
+};
+
+// Hashes the table data, so that a file that was damaged or replaced is
+// not mistaken for the generated table.
+static uint64_t checksum(const void* data, std::size_t size) {
+    const auto* bytes = static_cast<const unsigned char*>(data);
+    uint64_t hash = mix64(size);
+    std::size_t i = 0;
+    for(; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, bytes + i, sizeof(word));
+        hash = mix64(hash ^ word);
+    }
+    for(; i < size; ++i) {
+        hash = mix64(hash ^ bytes[i]);
+    }
+    return hash;
+}
+
+#ifdef TABLE_CACHE_MMAP
+// Creates dir with only the owner allowed in, and returns true if it is a
+// directory of the current user that nobody else can write to. Anyone who
+// can write to it could swap in their own tables.
+static bool secure_directory(const std::string& dir) {
+    std::error_code error;
+    auto parent = std::filesystem::path(dir).parent_path();
+    if(!parent.empty()) {
+        std::filesystem::create_directories(parent, error);
+    }
+    if(mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST) {
+        return false;
+    }
+    struct stat info;
+    return lstat(dir.c_str(), &info) == 0 && S_ISDIR(info.st_mode) &&
+           info.st_uid == geteuid() &&
+           (info.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+}
+
+// Maps path if it holds a table with the given key and size.
+static void* map_file(const std::string& path,
+        uint64_t key,
+        std::size_t size,
+        std::size_t& length) {
+    int fd = open(path.c_str(), O_RDONLY | O_NOFOLLOW);
+    if(fd < 0) {
+        return nullptr;
+    }
+    struct stat info;
+    length = sizeof(FileHeader) + size;
+    if(fstat(fd, &info) != 0 ||
+            static_cast<std::size_t>(info.st_size) != length) {
+        close(fd);
+        return nullptr;
+    }
+    void* mapping = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED) {
+        return nullptr;
+    }
+
+    const auto* header = static_cast<const FileHeader*>(mapping);
+    if(std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 ||
+            header->format_version != FORMAT_VERSION ||
+            header->header_size != sizeof(FileHeader) || header->key != key ||
+            header->size != size ||
+            header->checksum != checksum(header + 1, size)) {
+        munmap(mapping, length);
+        return nullptr;
+    }
+    return mapping;
+}
+
+// Writes size bytes of data to fd, retrying short writes.
+static bool write_all(int fd, const void* data, std::size_t size) {
+    const auto* bytes = static_cast<const char*>(data);
+    while(size > 0) {
+        ssize_t written = write(fd, bytes, size);
+        if(written < 0 && errno == EINTR) {
+            continue;
+        }
+        if(written <= 0) {
+            return false;
+        }
+        bytes += written;
+        size -= static_cast<std::size_t>(written);
+    }
+    return true;
+}
+
+// Writes the table to a new file with a unique name and renames it into
+// place, so other processes never see a partial file.
+static bool write_file(const std::string& path,
+        uint64_t key,
+        const void* data,
+        std::size_t size) {
+    FileHeader header = {};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.format_version = FORMAT_VERSION;
+    header.header_size = sizeof(FileHeader);
+    header.key = key;
+    header.size = size;
+    header.checksum = checksum(data, size);
+
+    // mkstemp creates the file exclusively, so it never follows a link
+    // someone else left under the name.
+    std::string tmp_path = path + ".XXXXXX";
+    int fd = mkstemp(tmp_path.data());
+    if(fd < 0) {
+        return false;
+    }
+    bool written = write_all(fd, &header, sizeof(header)) &&
+                   write_all(fd, data, size);
+    if(close(fd) != 0 || !written) {
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+    if(std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+#endif
+
+std::string CachedTable::cache_directory() {
+    if(const char* dir = std::getenv("TABLE_CACHE_DIR")) {
+        return dir;
+    }
+    const char* xdg = std::getenv("XDG_CACHE_HOME");
+    if(xdg != nullptr && xdg[0] != '\0') {
+        return std::string(xdg) + "/2048-ai";
+    }
+    const char* home = std::getenv("HOME");
+    if(home != nullptr && home[0] != '\0') {
+        return std::string(home) + "/.cache/2048-ai";
+    }
+    return "";
+}
+
+CachedTable CachedTable::load(const std::string& name,
+        uint64_t key,
+        std::size_t size,
+        const Generator& generate) {
+    auto start = std::chrono::steady_clock::now();
+    CachedTable table;
+    table.m_size = size;
+
+#ifdef TABLE_CACHE_MMAP
+    auto dir = cache_directory();
+    std::string path;
+    if(!dir.empty() && secure_directory(dir)) {
+        char key_str[17];
+        std::snprintf(key_str, sizeof(key_str), "%016llx",
+                static_cast<unsigned long long>(key));
+        path = dir + "/" + name + "-" + key_str + ".bin";
+
+        std::size_t length = 0;
+        if(void* mapping = map_file(path, key, size, length)) {
+            table.m_storage = std::make_shared<Storage>(mapping, length);
+        }
+    }
+#endif
+
+    if(!table.m_storage) {
+        auto storage = std::make_shared<Storage>(size);
+        generate(storage->memory(), size);
+        table.m_storage = storage;
+        table.m_generated = true;
+
+#ifdef TABLE_CACHE_MMAP
+        // Map the file that was just written, so the pages are shared with
+        // other processes from the start.
+        std::size_t length = 0;
+        if(!path.empty() && write_file(path, key, storage->data(), size)) {
+            if(void* mapping = map_file(path, key, size, length)) {
+                table.m_storage = std::make_shared<Storage>(mapping, length);
+            }
+        }
+#endif
+    }
+
+    table.m_load_time = std::chrono::steady_clock::now() - start;
+    return table;
+}
+
+const void* CachedTable::data() const {
+    return m_storage ? m_storage->data() : nullptr;
+}
+
+bool CachedTable::is_mapped() const {
+    return m_storage && m_storage->is_mapped();
+}
+
+std::ostream& operator<<(std::ostream& stream, const CachedTable& table) {
+    stream << table.size() / 1024 << " KiB "
+           << (table.was_generated() ? "generated" : "loaded") << " in "
+           << table.load_time().count() * 1e3 << " ms, "
+           << (table.is_mapped() ? "shared from the cache file"
+                                 : "in private memory");
+    return stream;
+}
@@ -0,0 +1,67 @@
+#ifndef TABLECACHE_H_
+#define TABLECACHE_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+
+// A block of read-only lookup table data, loaded from a cache file.
+//
+// The first process to ask for a table generates it and writes it to
+// <directory>/<name>-<key>.bin, every later one maps that file read-only,
+// so processes on the same host share the physical pages. key must change
+// whenever the generated data would, so it should combine a version number
+// with any parameters of the generator. If the file can not be read or
+// written, the table is generated into private memory instead.
+//
+// The directory is taken from the TABLE_CACHE_DIR environment variable,
+// or is 2048-ai in $XDG_CACHE_HOME or $HOME/.cache if it is not set.
+// Setting it to an empty string disables the cache. The directory is only
+// used if it belongs to the current user and nobody else can write to it,
+// and a file is only mapped if its data matches the checksum in its
+// header.
+class CachedTable {
+public:
+    using Generator = std::function<void(void* data, std::size_t size)>;
+
+    CachedTable() = default;
+    ~CachedTable() = default;
+
+    CachedTable(const CachedTable& other) = default;
+    CachedTable(CachedTable&& other) noexcept = default;
+    CachedTable& operator=(const CachedTable& other) = default;
+    CachedTable& operator=(CachedTable&& other) noexcept = default;
+
+    static CachedTable load(const std::string& name,
+            uint64_t key,
+            std::size_t size,
+            const Generator& generate);
+
+    static std::string cache_directory();
+
+    const void* data() const;
+    std::size_t size() const { return m_size; }
+    // True if the data is mapped from the cache file.
+    bool is_mapped() const;
+    // True if this process had to generate the data.
+    bool was_generated() const { return m_generated; }
+    // The time load() took.
+    std::chrono::duration<double> load_time() const { return m_load_time; }
+
+private:
+    class Storage;
+
+    std::shared_ptr<const Storage> m_storage;
+    std::size_t m_size = 0;
+    bool m_generated = false;
+    std::chrono::duration<double> m_load_time{0.0};
+};
+
+// Writes how the table was loaded and how long it took.
+std::ostream& operator<<(std::ostream& stream, const CachedTable& table);
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef THREADPOOL_H_
+#define THREADPOOL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// A fixed set of worker threads that run submitted tasks in the order they
+// were submitted. The workers are started once and live as long as the
+// pool, so a task costs a queue push rather than a thread start.
+class ThreadPool {
+public:
+    // Starts threads workers, or one per hardware thread if threads is 0.
+    explicit ThreadPool(int threads = 0);
+    // Finishes the queued tasks and joins the workers.
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool& other) = delete;
+    ThreadPool(ThreadPool&& other) noexcept = delete;
+    ThreadPool& operator=(const ThreadPool& other) = delete;
+    ThreadPool& operator=(ThreadPool&& other) noexcept = delete;
+
+    // Queues task and returns a future for its result.
+    template <typename F>
+    std::future<std::invoke_result_t<F>> submit(F&& task);
+
+    int size() const { return static_cast<int>(m_workers.size()); }
+
+private:
+    void run();
+
+    std::vector<std::thread> m_workers;
+    std::deque<std::function<void()>> m_tasks;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    bool m_stopping = false;
+};
+
+template <typename F>
+std::future<std::invoke_result_t<F>> ThreadPool::submit(F&& task) {
+    // std::function needs a copyable target, and a packaged_task is not.
+    using Result = std::invoke_result_t<F>;
+    auto packaged = std::make_shared<std::packaged_task<Result()>>(
+            std::forward<F>(task));
+    auto future = packaged->get_future();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_tasks.emplace_back([packaged]() { (*packaged)(); });
+    }
+    m_wake.notify_one();
+    return future;
+}
+
+#endif
@@ -100,7 +100,7 @@ ImVec2 to_imvec2(sf::Vector2<T> in) {
 }
 
 Window::Window(uint64_t seed, int repeat)
-    : m_board(4, 4, seed), m_repeat(repeat) {}
+    : m_board(seed), m_repeat(repeat) {}
 
 Window::~Window() {
     glDeleteTextures(1, &m_font_tex);
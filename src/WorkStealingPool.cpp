@@ -0,0 +1,160 @@
+#include "WorkStealingPool.h"
+
+#include <algorithm>
+
+#include "Hash.h"
+
+// The worker the current thread runs as, or -1 outside of a pool.
+static thread_local int current_worker = -1;
+
+WorkStealingPool::WorkStealingPool(int threads) {
+    if(threads <= 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for(int i = 0; i < threads; ++i) {
+        m_workers.push_back(std::make_unique<Worker>());
+        m_workers.back()->rng_state = i + 1;
+    }
+    for(int i = 1; i < threads; ++i) {
+        m_threads.emplace_back([this, i]() { worker_loop(i); });
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+    for(auto& thread : m_threads) {
+        thread.join();
+    }
+}
+
+void WorkStealingPool::run(const std::function<void()>& root) {
+    current_worker = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_active = true;
+    }
+    m_wake.notify_all();
+    root();
+    m_active = false;
+    current_worker = -1;
+}
+
+void WorkStealingPool::spawn(TaskGroup& group, Task& task) {
+    task.m_group = &group;
+    group.m_pending.fetch_add(1, std::memory_order_relaxed);
+    auto& worker = *m_workers[current_worker];
+    if(!worker.deque.push(&task)) {
+        execute(worker, &task);
+    }
+}
+
+void WorkStealingPool::wait(TaskGroup& group) {
+    auto& worker = *m_workers[current_worker];
+    bool idle = false;
+    std::chrono::steady_clock::time_point idle_since;
+    while(group.m_pending.load(std::memory_order_acquire) > 0) {
+        if(Task* task = find_task(worker)) {
+            if(idle) {
+                add_idle(worker, idle_since);
+                idle = false;
+            }
+            execute(worker, task);
+        } else if(!idle) {
+            idle = true;
+            idle_since = std::chrono::steady_clock::now();
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    if(idle) {
+        add_idle(worker, idle_since);
+    }
+}
+
+void WorkStealingPool::worker_loop(int index) {
+    current_worker = index;
+    auto& worker = *m_workers[index];
+    while(true) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [this]() { return m_stopping || m_active; });
+            if(m_stopping) {
+                return;
+            }
+        }
+
+        // Between runs the workers sleep, during one they keep looking
+        // for work.
+        auto idle_since = std::chrono::steady_clock::now();
+        while(m_active.load(std::memory_order_acquire)) {
+            if(Task* task = find_task(worker)) {
+                add_idle(worker, idle_since);
+                execute(worker, task);
+                idle_since = std::chrono::steady_clock::now();
+            } else {
+                std::this_thread::yield();
+            }
+        }
+        add_idle(worker, idle_since);
+    }
+}
+
+WorkStealingPool::Task* WorkStealingPool::find_task(Worker& worker) {
+    if(Task* task = worker.deque.pop()) {
+        return task;
+    }
+    // Start at a random victim, so thieves spread over the workers.
+    int count = size();
+    int first = static_cast<int>(splitmix64(worker.rng_state) % count);
+    for(int i = 0; i < count; ++i) {
+        auto& victim = *m_workers[(first + i) % count];
+        if(&victim == &worker) {
+            continue;
+        }
+        if(Task* task = victim.deque.steal()) {
+            worker.steals.fetch_add(1, std::memory_order_relaxed);
+            return task;
+        }
+    }
+    return nullptr;
+}
+
+void WorkStealingPool::execute(Worker& worker, Task* task) {
+    // The group may be freed as soon as its count reaches 0.
+    TaskGroup* group = task->m_group;
+    task->execute();
+    worker.tasks.fetch_add(1, std::memory_order_relaxed);
+    group->m_pending.fetch_sub(1, std::memory_order_release);
+}
+
+void WorkStealingPool::add_idle(
+        Worker& worker, std::chrono::steady_clock::time_point since) {
+    auto idle = std::chrono::steady_clock::now() - since;
+    worker.idle_ns.fetch_add(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(idle).count(),
+            std::memory_order_relaxed);
+}
+
+WorkStealingStats WorkStealingPool::stats() const {
+    WorkStealingStats stats;
+    int64_t idle_ns = 0;
+    for(const auto& worker : m_workers) {
+        stats.tasks += worker->tasks.load(std::memory_order_relaxed);
+        stats.steals += worker->steals.load(std::memory_order_relaxed);
+        idle_ns += worker->idle_ns.load(std::memory_order_relaxed);
+    }
+    stats.idle = std::chrono::nanoseconds(idle_ns);
+    return stats;
+}
+
+void WorkStealingPool::reset_stats() {
+    for(auto& worker : m_workers) {
+        worker->tasks.store(0, std::memory_order_relaxed);
+        worker->steals.store(0, std::memory_order_relaxed);
+        worker->idle_ns.store(0, std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,206 @@
+#ifndef WORKSTEALINGPOOL_H_
+#define WORKSTEALINGPOOL_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed size Chase-Lev work stealing deque. The owning thread pushes and
+// pops at the bottom, any other thread steals from the top. Only the owner
+// may call push and pop.
+//
+// Follows "Correct and Efficient Work-Stealing for Weak Memory Models"
+// (Le, Pop, Cohen, Zappa Nardelli, 2013), without growing the buffer: a
+// push to a full deque fails and the caller runs the item itself.
+template <typename T, int Capacity = 4096>
+class ChaseLevDeque {
+public:
+    static_assert((Capacity & (Capacity - 1)) == 0,
+            "The capacity must be a power of two");
+
+    ChaseLevDeque() = default;
+    ~ChaseLevDeque() = default;
+
+    ChaseLevDeque(const ChaseLevDeque& other) = delete;
+    ChaseLevDeque(ChaseLevDeque&& other) noexcept = delete;
+    ChaseLevDeque& operator=(const ChaseLevDeque& other) = delete;
+    ChaseLevDeque& operator=(ChaseLevDeque&& other) noexcept = delete;
+
+    bool push(T* item);
+    // Returns the newest item, or nullptr if the deque is empty.
+    T* pop();
+    // Returns the oldest item, or nullptr if the deque is empty or another
+    // thread took the item first.
+    T* steal();
+
+private:
+    static constexpr int64_t MASK = Capacity - 1;
+
+    alignas(64) std::atomic<int64_t> m_top{0};
+    alignas(64) std::atomic<int64_t> m_bottom{0};
+    alignas(64) std::atomic<T*> m_items[Capacity];
+};
+
+template <typename T, int Capacity>
+bool ChaseLevDeque<T, Capacity>::push(T* item) {
+    int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+    int64_t top = m_top.load(std::memory_order_acquire);
+    if(bottom - top >= Capacity) {
+        return false;
+    }
+    m_items[bottom & MASK].store(item, std::memory_order_relaxed);
+    // Publishes the item, and whatever it points to, to thieves.
+    m_bottom.store(bottom + 1, std::memory_order_release);
+    return true;
+}
+
+template <typename T, int Capacity>
+T* ChaseLevDeque<T, Capacity>::pop() {
+    int64_t bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+    m_bottom.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t top = m_top.load(std::memory_order_relaxed);
+    if(top > bottom) {
+        m_bottom.store(bottom + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    T* item = m_items[bottom & MASK].load(std::memory_order_relaxed);
+    if(top == bottom) {
+        // The last item, which a thief may be taking at the same time.
+        if(!m_top.compare_exchange_strong(top,
+                   top + 1,
+                   std::memory_order_seq_cst,
+                   std::memory_order_relaxed)) {
+            item = nullptr;
+        }
+        m_bottom.store(bottom + 1, std::memory_order_relaxed);
+    }
+    return item;
+}
+
+template <typename T, int Capacity>
+T* ChaseLevDeque<T, Capacity>::steal() {
+    int64_t top = m_top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t bottom = m_bottom.load(std::memory_order_acquire);
+    if(top >= bottom) {
+        return nullptr;
+    }
+    T* item = m_items[top & MASK].load(std::memory_order_relaxed);
+    if(!m_top.compare_exchange_strong(top,
+               top + 1,
+               std::memory_order_seq_cst,
+               std::memory_order_relaxed)) {
+        return nullptr;
+    }
+    return item;
+}
+
+// Totals over all workers since the last reset_stats().
+struct WorkStealingStats {
+    int64_t tasks = 0;
+    // Tasks taken from the deque of another worker.
+    int64_t steals = 0;
+    // Time workers spent looking for work during run().
+    std::chrono::duration<double> idle{0.0};
+};
+
+// Runs fork-join tasks on a fixed set of workers, each with a Chase-Lev
+// deque. A task spawns its children onto the deque of the worker running
+// it and then helps run tasks until they are done, so the deepest work
+// stays local and idle workers steal the oldest, largest tasks.
+//
+// The thread that calls run() becomes worker 0 for the duration of the
+// call. Tasks and groups live on the stack of the code that waits for them,
+// so spawning does not allocate.
+class WorkStealingPool {
+public:
+    class TaskGroup;
+
+    class Task {
+    public:
+        Task() = default;
+        virtual ~Task() = default;
+
+        Task(const Task& other) = delete;
+        Task(Task&& other) noexcept = delete;
+        Task& operator=(const Task& other) = delete;
+        Task& operator=(Task&& other) noexcept = delete;
+
+        virtual void execute() = 0;
+
+    private:
+        friend class WorkStealingPool;
+        TaskGroup* m_group = nullptr;
+    };
+
+    // Counts the unfinished tasks spawned into it.
+    class TaskGroup {
+    public:
+        TaskGroup() = default;
+        ~TaskGroup() = default;
+
+        TaskGroup(const TaskGroup& other) = delete;
+        TaskGroup(TaskGroup&& other) noexcept = delete;
+        TaskGroup& operator=(const TaskGroup& other) = delete;
+        TaskGroup& operator=(TaskGroup&& other) noexcept = delete;
+
+    private:
+        friend class WorkStealingPool;
+        std::atomic<int> m_pending{0};
+    };
+
+    // Uses threads workers including the caller of run(), or one per
+    // hardware thread if threads is 0.
+    explicit WorkStealingPool(int threads = 0);
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool& other) = delete;
+    WorkStealingPool(WorkStealingPool&& other) noexcept = delete;
+    WorkStealingPool& operator=(const WorkStealingPool& other) = delete;
+    WorkStealingPool& operator=(WorkStealingPool&& other) noexcept = delete;
+
+    // Runs root on the calling thread with the workers stealing from it.
+    // Only one run() may be active at a time.
+    void run(const std::function<void()>& root);
+    // Queues task as part of group. Must be called from inside run(). If
+    // the deque is full, the task is run right away.
+    void spawn(TaskGroup& group, Task& task);
+    // Runs tasks until every task of group is done.
+    void wait(TaskGroup& group);
+
+    int size() const { return static_cast<int>(m_workers.size()); }
+    WorkStealingStats stats() const;
+    void reset_stats();
+
+private:
+    struct alignas(64) Worker {
+        ChaseLevDeque<Task> deque;
+        std::atomic<int64_t> tasks{0};
+        std::atomic<int64_t> steals{0};
+        std::atomic<int64_t> idle_ns{0};
+        uint64_t rng_state = 0;
+    };
+
+    void worker_loop(int index);
+    // Takes a task from the own deque, or steals one from another worker.
+    Task* find_task(Worker& worker);
+    void execute(Worker& worker, Task* task);
+    static void add_idle(Worker& worker,
+            std::chrono::steady_clock::time_point since);
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::vector<std::thread> m_threads;
+    std::atomic<bool> m_active{false};
+    bool m_stopping = false;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+};
+
+#endif
@@ -2,20 +2,25 @@
 
 #include <GL/gl3w.h>
 
+#include "Benchmark.h"
+#include "MoveTables.h"
 #include "Window.h"
 
 #include "cxxopts.hpp"
 
+#include "AI/ExpectimaxController.h"
 #include "AI/MctsController.h"
 #include "AI/MinimaxController.h"
 #include "AI/RandomController.h"
+#include "AI/SearchOptions.h"
 #include "AI/TestController.h"
 #include "HumanGameController.h"
 #include "IGameController.h"
 
 cxxopts::ParseResult parse_opts(int argc, char** argv);
-std::unique_ptr<IGameController> create_controller(
-        const std::string& name, uint64_t seed = 0);
+std::unique_ptr<IGameController> create_controller(const std::string& name,
+        uint64_t seed = 0,
+        const SearchOptions& search_options = {});
 
 int main(int argc, char** argv) {
     cxxopts::Options options(
@@ -26,11 +31,32 @@ int main(int argc, char** argv) {
             "d,delay",
             "The delay time between AI moves, in milliseconds",
             cxxopts::value<double>()->default_value("0.0"))(
-            "h,help", "Print help")("s,seed",
+            "h,help", "Print help")("b,benchmark",
+            "Run the board kernel benchmarks and exit")("s,seed",
             "The initial seed to use for random number generators",
             cxxopts::value<uint64_t>())("r,repeat",
             "How many turns to make per frame",
-            cxxopts::value<int>()->default_value("1"));
+            cxxopts::value<int>()->default_value("1"))("depth",
+            "The search depth, in moves for Expectimax and in plies (a "
+            "move or a spawn) for Minimax, or 0 to adapt it to the board",
+            cxxopts::value<int>()->default_value("0"))("time-per-move",
+            "The search time per move in milliseconds, or 0 for no limit",
+            cxxopts::value<double>()->default_value("0.0"))("threads",
+            "The number of threads a search may use",
+            cxxopts::value<int>()->default_value("1"))("split-depth",
+            "Split expectimax chance nodes this many moves from the leaves "
+            "into stealable tasks, or 0 to only split the root",
+            cxxopts::value<int>()->default_value("0"))("min-probability",
+            "Search branches less likely than this are evaluated statically",
+            cxxopts::value<double>()->default_value("0.001"))("chance-pruning",
+            "How expectimax prunes chance nodes, 'none', 'star1' or 'star2'",
+            cxxopts::value<std::string>()->default_value("star1"))("hash-mb",
+            "The size of the transposition table in MiB",
+            cxxopts::value<std::size_t>()->default_value("16"))("huge-pages",
+            "Back the transposition table with huge pages")("clear-table",
+            "Empty the transposition table before every move")("replacement",
+            "The transposition table replacement policy, 'depth' or 'always'",
+            cxxopts::value<std::string>()->default_value("depth"));
 
     auto args = options.parse(argc, argv);
 
@@ -38,6 +64,7 @@ int main(int argc, char** argv) {
         std::cout << options.help() << std::endl;
         std::cout << "Available Controllers:\n"
                   << "\tHumanController\n"
+                  << "\tExpectimaxController\n"
                   << "\tRandomController\n"
                   << "\tMctsController\n"
                   << "\tMinimaxController\n"
@@ -53,14 +80,53 @@ int main(int argc, char** argv) {
         seed_val = now.time_since_epoch().count();
     }
 
+    if(args.count("benchmark") > 0) {
+        run_benchmarks(std::cout, seed_val);
+        return 0;
+    }
+
     auto controller_name = args["controller"].as<std::string>();
     std::cout << "Selecting " << controller_name << "..." << std::endl;
-    auto controller = create_controller(controller_name, seed_val);
+    SearchOptions search_options;
+    search_options.depth = args["depth"].as<int>();
+    search_options.time_per_move = std::chrono::duration<double, std::milli>(
+            args["time-per-move"].as<double>());
+    search_options.threads = args["threads"].as<int>();
+    search_options.split_depth = args["split-depth"].as<int>();
+    search_options.min_probability = args["min-probability"].as<double>();
+    auto chance_pruning = args["chance-pruning"].as<std::string>();
+    if(chance_pruning == "none") {
+        search_options.chance_pruning = ChancePruning::None;
+    } else if(chance_pruning == "star1") {
+        search_options.chance_pruning = ChancePruning::Star1;
+    } else if(chance_pruning == "star2") {
+        search_options.chance_pruning = ChancePruning::Star2;
+    } else {
+        std::cerr << "Unknown chance pruning '" << chance_pruning << "'."
+                  << std::endl;
+        return -1;
+    }
+    search_options.table_megabytes = args["hash-mb"].as<std::size_t>();
+    search_options.huge_pages = args.count("huge-pages") > 0;
+    search_options.keep_table = args.count("clear-table") == 0;
+    auto replacement = args["replacement"].as<std::string>();
+    if(replacement == "depth") {
+        search_options.replacement = ReplacementPolicy::DepthPreferred;
+    } else if(replacement == "always") {
+        search_options.replacement = ReplacementPolicy::Always;
+    } else {
+        std::cerr << "Unknown replacement policy '" << replacement << "'."
+                  << std::endl;
+        return -1;
+    }
+    auto controller =
+            create_controller(controller_name, seed_val, search_options);
     if(!controller) {
         std::cerr << "Unknown controller '" << controller_name << "'."
                   << std::endl;
         return -1;
     }
+    std::cout << "Move tables: " << MoveTables::cache() << std::endl;
 
     Window w(seed_val + 1, args["repeat"].as<int>());
     w.set_delay(std::chrono::duration<double, std::milli>(
@@ -79,16 +145,19 @@ cxxopts::ParseResult parse_opts(int argc, char** argv) {
     return options.parse(argc, argv);
 }
 
-std::unique_ptr<IGameController> create_controller(
-        const std::string& name, uint64_t seed) {
+std::unique_ptr<IGameController> create_controller(const std::string& name,
+        uint64_t seed,
+        const SearchOptions& search_options) {
     if(name == "HumanController") {
         return std::make_unique<HumanGameController>();
     } else if(name == "RandomController") {
         return std::make_unique<RandomController>(seed);
+    } else if(name == "ExpectimaxController") {
+        return std::make_unique<ExpectimaxController>(seed, search_options);
     } else if(name == "MctsController") {
         return std::make_unique<MctsController>(seed);
     } else if(name == "MinimaxController") {
-        return std::make_unique<MinimaxController>(seed);
+        return std::make_unique<MinimaxController>(seed, search_options);
     } else if(name == "TestController") {
         return std::make_unique<TestController>(seed);
     } else {